@@ -37,6 +37,7 @@
 #include <cinttypes>
 #include <cstddef> // offsetof
 #include <cstdlib>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -230,6 +231,7 @@ protected:
     bool m_DebugNRI = false;
     bool m_AlwaysActive = false;
     bool m_Resizable = false;
+    bool m_ShaderBundle = false;
 
     // Private
 private:
@@ -6,12 +6,21 @@
 #undef TRANSPARENT
 
 namespace utils {
+class FileView;
+class LoadSceneHandle;
+class TextureStreamer;
 struct Texture;
+struct AnimationActor;
+struct Instance;
+struct Mesh;
+struct MorphVertex;
 struct Scene;
+struct SceneLoadingContext;
 
-typedef std::vector<std::vector<uint8_t>> ShaderCodeStorage;
+typedef std::vector<FileView> ShaderCodeStorage;
 typedef void* Mip;
 typedef uint32_t Index;
+typedef std::function<void(uint32_t begin, uint32_t end, uint32_t threadIndex)> ParallelForCallback;
 
 constexpr uint32_t InvalidIndex = uint32_t(-1);
 
@@ -51,17 +60,187 @@ enum class AnimationTrackType : uint8_t {
     CubicSpline
 };
 
+enum class AnimationTrackTarget : uint8_t {
+    TRANSLATION,
+    ROTATION,
+    SCALE
+};
+
+enum class SceneLoadingStage : uint8_t {
+    PARSE,
+    GEOMETRY,
+    TANGENTS,
+    ANIMATIONS,
+    TEXTURES,
+
+    MAX_NUM
+};
+
+struct LoadSceneDesc {
+    TextureStreamer* textureStreamer = nullptr; // if provided, scene textures get registered for mip streaming
+    bool allowUpdate = false;                   // if "false", instances are static unless animated or morphed
+    bool useCache = false;                      // read or write a binary snapshot "<path>.cache" (only if "scene" is empty), the scene folder must be writable
+    bool allow16BitIndices = false;             // meshes with up to 65536 vertices (without morph targets) store indices in "Scene::indices16"
+    bool generateCompactVertices = false;       // also fill "Scene::compactVertices"
+    bool generateVertexStreams = false;         // also fill "Scene::vertexPositions" and "Scene::vertexAttributes" (see "Mesh::streamVertexOffset")
+    bool sparseMorphTargets = false;            // morph targets store only affected vertices in "Scene::morphDeltas" (see "ExpandMorphTarget")
+    bool compressAnimations = false;            // error-bounded key reduction and quantization of animation tracks (see "AnimationTrackGroup::isQuantized")
+    bool keepUnpackedVertices = true;           // if "false", "Scene::unpackedVertices" stays empty (use "UnpackVertex" to decode "Scene::vertices")
+    bool optimizeMeshes = false;                // weld vertices, remove degenerate triangles, optimize for vertex cache, overdraw and vertex fetch
+    uint32_t lodNum = 0;                        // max number of simplified LODs per mesh (without morph targets), each has about a half of primitives of the previous one
+    uint32_t meshletMaxVertexNum = 0;           // if not "0", meshes get split into meshlets (max 255)
+    uint32_t meshletMaxPrimitiveNum = 124;      // max 512, a multiple of 4
+};
+
+struct TextureStreamerDesc {
+    uint64_t cpuMemoryBudget = 64ull << 20;   // max size of mips paged in by a single "Update" (they are released by the next one)
+    uint64_t gpuMemoryBudget = 1024ull << 20; // max size of resident mips of all textures
+    uint32_t tailMipSize = 128;               // mips not bigger than this are always resident
+};
+
 const char* GetFileName(const std::string& path);
 std::string GetFullPath(const std::string& localPath, DataFolder dataFolder);
 bool LoadFile(const std::string& path, std::vector<uint8_t>& data);
 nri::ShaderDesc LoadShader(nri::GraphicsAPI graphicsAPI, const std::string& path, ShaderCodeStorage& storage, const char* entryPointName = nullptr);
-bool LoadTexture(const std::string& path, Texture& texture, bool computeAvgColorAndAlphaMode = false);
+// Packs all compiled shaders of the API (including subfolders) into "Shaders<ext>.bundle", which "LoadShader" maps once and prefers
+// (in debug builds unless the loose file has changed since). Invoked by "SampleBase" with "--shaderBundle", i.e. run a sample with it
+// after shaders get recompiled. Must not run concurrently with "LoadShader", bytecode previously returned from the bundle gets invalid
+bool CreateShaderBundle(nri::GraphicsAPI graphicsAPI);
+bool LoadTexture(const std::string& path, Texture& texture, bool computeAvgColorAndAlphaMode = false, uint32_t alphaScanMipSize = 0); // if not "0", mapped mips bigger than this are not scanned for transparency (see "TextureStreamerDesc::tailMipSize")
 void LoadTextureFromMemory(nri::Format format, uint32_t width, uint32_t height, const uint8_t* pixels, Texture& texture);
 bool LoadTextureFromMemory(const std::string& name, const uint8_t* data, int dataSize, Texture& texture, bool computeAvgColorAndAlphaMode);
-bool LoadScene(const std::string& path, Scene& scene, bool allowUpdate);
+bool LoadScene(const std::string& path, Scene& scene, const LoadSceneDesc& loadSceneDesc);
+
+inline bool LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
+    LoadSceneDesc loadSceneDesc = {};
+    loadSceneDesc.allowUpdate = allowUpdate;
+
+    return LoadScene(path, scene, loadSceneDesc);
+}
+
+// "scene" must not be accessed until "IsGeometryReady()" and must outlive the handle
+LoadSceneHandle LoadSceneAsync(const std::string& path, Scene& scene, const LoadSceneDesc& loadSceneDesc = {});
+
+// Writes "Mesh::vertexNum" dense vertices of a morph target, works for sparse and dense targets
+void ExpandMorphTarget(const Scene& scene, const Mesh& mesh, uint32_t morphTargetIndex, MorphVertex* morphVertices);
+
+// The coarsest LOD with projected error below "maxPixelError": "0" - the mesh itself, "N" - "scene.meshLods[mesh.lodOffset + N - 1]"
+uint32_t SelectMeshLod(const Scene& scene, const Instance& instance, const CameraState& camera, float viewportHeight, float maxPixelError = 1.0f);
+
+// Frustum culling of "Scene::instances" against "CameraState::mWorldToClip" (relative or absolute), "visibleInstanceIndices[i]" gets sorted indices of instances visible by "cameras[i]"
+void CullInstances(const Scene& scene, const CameraState* cameras, uint32_t cameraNum, std::vector<uint32_t>* visibleInstanceIndices);
+
+// Batched playback: advances clips of "actors" by "elapsedSec" and blends them into "AnimationActor::worldTransforms", actors are processed in parallel ("scene" is not modified)
+void AnimateActors(const Scene& scene, AnimationActor* actors, uint32_t actorNum, float elapsedSec);
+
+// Worker pool, "threadIndex" is unique among threads executing the same "ParallelFor" and is in [0; GetThreadNum())
+uint32_t GetThreadNum();
+void ParallelFor(uint32_t num, uint32_t grainSize, const ParallelForCallback& callback);
+
+// Read-only file contents, memory mapped if possible (pages are loaded on demand), read into memory otherwise
+class FileView {
+public:
+    FileView() = default;
+    FileView(const FileView&) = delete;
+    FileView(FileView&& other) noexcept;
+    FileView& operator=(const FileView&) = delete;
+    FileView& operator=(FileView&& other) noexcept;
+    ~FileView();
+
+    bool Open(const std::string& path);
+    void Close();
+
+    // Page residency hints for a range within the view
+    void Prefetch(const uint8_t* data, size_t size) const;
+    void Discard(const uint8_t* data, size_t size) const;
+
+    inline const uint8_t* GetData() const {
+        return m_Data;
+    }
+
+    inline size_t GetSize() const {
+        return m_Size;
+    }
+
+    inline bool IsOpen() const {
+        return m_IsOpen;
+    }
+
+    inline bool IsMapped() const {
+        return m_IsMapped;
+    }
+
+private:
+    const uint8_t* m_Data = nullptr;
+    size_t m_Size = 0;
+    bool m_IsMapped = false;
+    bool m_IsOpen = false; // an empty file has no data
+};
+
+// Geometry, materials, instances and animations can be used after "IsGeometryReady()", materials reference static
+// textures until "Finish()" moves decoded textures into the scene. "Finish()" must be called explicitly, a handle destroyed
+// without it only waits for the loader thread and drops decoded textures (the scene is not touched)
+class LoadSceneHandle {
+public:
+    LoadSceneHandle() = default;
+    explicit LoadSceneHandle(SceneLoadingContext* context)
+        : m_Context(context) {
+    }
+
+    LoadSceneHandle(const LoadSceneHandle&) = delete;
+    LoadSceneHandle(LoadSceneHandle&& other) noexcept;
+    LoadSceneHandle& operator=(const LoadSceneHandle&) = delete;
+    LoadSceneHandle& operator=(LoadSceneHandle&& other) noexcept;
+    ~LoadSceneHandle(); // waits for loading completion, doesn't commit textures
+
+    float GetProgress(SceneLoadingStage stage) const; // [0; 1]
+    float GetProgress() const;                        // average of all stages
+    bool IsGeometryReady() const;
+    bool IsDone() const; // "Finish" doesn't block
+    bool Finish();       // waits for loading completion, returns the result
+
+private:
+    SceneLoadingContext* m_Context = nullptr;
+};
+
+// Mip streaming: only tail mips are resident after "Register", finer mips are paged in and out by "Update" according
+// to requests and budgets. Textures whose residency changed must be updated on the GPU before the next "Update". Only DDS
+// mips stream (they reference the mapped file), PNG/JPG textures are fully decoded on load and stay resident
+class TextureStreamer {
+public:
+    TextureStreamer(const TextureStreamerDesc& textureStreamerDesc)
+        : m_Desc(textureStreamerDesc) {
+    }
+
+    void Register(Texture& texture); // ignored if mips don't reference a mapped file, i.e. the texture stays fully resident outside of budgets
+    void Unregister(Texture& texture); // must be called before the texture gets destroyed
+    void Request(Texture& texture, uint32_t mipIndex); // "mipIndex" and coarser mips are needed for the current frame
+    const std::vector<Texture*>& Update();            // returns textures with changed residency
+
+    inline uint64_t GetResidentSize() const {
+        return m_ResidentSize;
+    }
+
+    inline uint32_t GetTailMipSize() const {
+        return m_Desc.tailMipSize;
+    }
+
+    inline uint64_t GetFrameIndex() const {
+        return m_FrameIndex;
+    }
+
+private:
+    TextureStreamerDesc m_Desc = {};
+    std::vector<Texture*> m_Textures;
+    std::vector<Texture*> m_ChangedTextures;
+    std::vector<std::pair<Texture*, uint32_t>> m_PagedInMips;
+    uint64_t m_ResidentSize = 0;
+    uint64_t m_FrameIndex = 1;
+};
 
 struct Texture {
     std::string name;
+    FileView file; // if open, mips reference the file contents
     Mip* mips = nullptr;
     AlphaMode alphaMode = AlphaMode::OPAQUE;
     nri::Format format = nri::Format::UNKNOWN;
@@ -71,10 +250,25 @@ struct Texture {
     uint8_t mipNum = 0;
     uint16_t layerNum = 0;
 
+    // Streaming, mips [residentMipOffset; mipNum) are resident
+    uint64_t lastUseFrame = 0;
+    uint8_t tailMipOffset = 0;
+    uint8_t requestedMipOffset = 0;
+    uint8_t residentMipOffset = 0;
+
     ~Texture();
 
     bool IsBlockCompressed() const;
-    void GetSubresource(nri::TextureSubresourceUploadDesc& subresource, uint32_t mipIndex, uint32_t arrayIndex = 0) const;
+    bool GetSubresource(nri::TextureSubresourceUploadDesc& subresource, uint32_t mipIndex, uint32_t arrayIndex = 0) const; // "false" if not resident
+    size_t GetMipSize(uint32_t mipIndex) const;
+
+    inline bool IsMipResident(uint32_t mipIndex) const {
+        return mipIndex >= residentMipOffset && mipIndex < mipNum;
+    }
+
+    inline uint8_t GetResidentMipOffset() const {
+        return residentMipOffset;
+    }
 
     inline void OverrideFormat(nri::Format fmt) {
         this->format = fmt;
@@ -155,17 +349,34 @@ struct Instance {
 struct Mesh {
     cBoxf aabb; // must be manually adjusted by instance.rotation.GetScale()
     uint32_t vertexOffset = 0;
-    uint32_t indexOffset = 0;
+    uint32_t indexOffset = 0; // in "Scene::indices16" if "indexType" is "UINT16", in "Scene::indices" otherwise
     uint32_t indexNum = 0;
     uint32_t vertexNum = 0;
+    uint32_t primitiveOffset = 0; // in "Scene::primitives"
+    uint32_t meshletOffset = 0;
+    uint32_t meshletNum = 0;
+    uint32_t lodOffset = 0; // in "Scene::meshLods", the mesh itself is LOD 0
+    uint32_t lodNum = 0;
+    uint32_t streamVertexOffset = InvalidIndex; // in "Scene::vertexPositions" and "Scene::vertexAttributes", if generated
+    nri::IndexType indexType = nri::IndexType::UINT32;
 
     uint32_t morphMeshIndexOffset = InvalidIndex;
-    uint32_t morphTargetVertexOffset = InvalidIndex;
+    uint32_t morphTargetVertexOffset = InvalidIndex; // in "Scene::morphVertices", "morphTargetNum" dense targets or only the rest pose if sparse
+    uint32_t morphTargetOffset = InvalidIndex;       // in "Scene::morphTargets", if sparse
     uint32_t morphTargetNum = 0;
 
     inline bool HasMorphTargets() const {
         return morphTargetNum != 0;
     }
+
+    // "CompactVertex" position dequantization: "bias + pos * scale"
+    inline float3 GetPositionScale() const {
+        return aabb.vMax - aabb.vMin;
+    }
+
+    inline float3 GetPositionBias() const {
+        return aabb.vMin;
+    }
 };
 
 // per mesh instance data
@@ -184,12 +395,45 @@ struct Vertex {
     uint32_t T; // 10 10 10 2 unorm (.w - handedness)
 };
 
+// Split "Vertex" streams: positions only passes and acceleration structure builds read 12 bytes per vertex instead of 24
+struct VertexPosition {
+    float pos[3];
+};
+
+struct VertexAttributes {
+    float16_t2 uv;
+    uint32_t N; // 10 10 10 2 unorm
+    uint32_t T; // 10 10 10 2 unorm (.w - handedness)
+};
+
+// 16 bytes, see "Utils.hlsli" for decoding in shaders
+struct CompactVertex {
+    uint16_t pos[3]; // unorm 16 16 16, quantized against "Mesh::aabb"
+    uint16_t T;      // octahedral unorm 8 7, bit 15 - negative handedness
+    uint32_t N;      // octahedral unorm 16 16
+    float16_t2 uv;
+};
+
 struct MorphVertex {
     float16_t4 pos;
     float16_t2 N;
     float16_t2 T;
 };
 
+// A vertex of a sparse morph target, which differs from the rest pose
+struct MorphDelta {
+    uint32_t vertexIndex; // relative to "Mesh::vertexOffset"
+    int16_t pos[4];       // ".xyz" - position delta in "MorphTarget::positionScale" units, ".w" - handedness
+    float16_t2 N;
+    float16_t2 T;
+};
+
+struct MorphTarget {
+    uint32_t deltaOffset; // in "Scene::morphDeltas"
+    uint32_t deltaNum;
+    float positionScale;
+};
+
 struct UnpackedVertex {
     float pos[3];
     float uv[2];
@@ -197,37 +441,58 @@ struct UnpackedVertex {
     float T[4];
 };
 
+// On-demand decoding if "Scene::unpackedVertices" is not available (precision is limited by "Vertex")
+UnpackedVertex UnpackVertex(const Vertex& vertex);
+
 struct Primitive {
     float worldArea;
     float uvArea;
 };
 
+// Uses the vertices of the mesh
+struct MeshLod {
+    uint32_t indexOffset; // in "Scene::indices16" or "Scene::indices", the same as the mesh
+    uint32_t indexNum;
+    float error; // max deviation from the original mesh in mesh space
+};
+
+// Bounds are in mesh space, the normal cone is backfacing if "dot(normalize(coneApex - cameraPos), coneAxis) >= coneCutoff"
+struct Meshlet {
+    float sphere[4]; // center, radius
+    float coneApex[3];
+    float coneCutoff;
+    float coneAxis[3];
+    uint32_t vertexOffset;    // in "Scene::meshletVertices"
+    uint32_t primitiveOffset; // in "Scene::meshletPrimitives", 4 bytes aligned
+    uint32_t vertexNum;
+    uint32_t primitiveNum;
+};
+
+// "Scene::sceneNodes" are stored in depth-first order, i.e. a node is followed by its "descendantNum" descendants
 struct SceneNode {
-    std::vector<SceneNode*> children;
     std::vector<uint32_t> instances;
     std::string name;
-    SceneNode* parent = nullptr;
     float4x4 localTransform;
     float4x4 worldTransform;
     float4 rotation;
     float3 translation;
     float3 scale;
+    uint32_t parentIndex = InvalidIndex;
+    uint32_t descendantNum = 0;
 };
 
-struct VectorAnimationTrack {
-    std::vector<float> keys;
-    std::vector<float3> values;
-    SceneNode* node = nullptr;
-    uint32_t frameCount = 0;
-    AnimationTrackType type = AnimationTrackType::Linear;
-};
-
-struct QuatAnimationTrack {
-    std::vector<float> keys;
-    std::vector<float4> values;
-    SceneNode* node = nullptr;
-    uint32_t frameCount = 0;
+// Up to 4 tracks with the same keys, target and interpolation, evaluated together. Values of a key are SoA: "x[4], y[4], z[4]" (and "w[4]" for rotations).
+// Quantized values are 12 "uint16_t" per key: translation and scale are "unorm16" in the per-track range, rotations are "smallest three" (the low bits of "x" and "y" hold the index of the omitted component)
+struct AnimationTrackGroup {
+    uint32_t nodeIndices[4] = {InvalidIndex, InvalidIndex, InvalidIndex, InvalidIndex}; // in "Scene::sceneNodes", "InvalidIndex" for unused lanes
+    uint32_t keyOffset = 0;              // in "Animation::keys"
+    uint32_t keyNum = 0;
+    uint32_t valueOffset = 0;            // in "Animation::values" or "Animation::quantizedValues"
+    uint32_t rangeOffset = InvalidIndex; // in "Animation::values", "min[3][4]" and "step[3][4]" of quantized translation and scale
+    uint32_t keyCursor = 0;              // the last found key
+    AnimationTrackTarget target = AnimationTrackTarget::TRANSLATION;
     AnimationTrackType type = AnimationTrackType::Linear;
+    bool isQuantized = false;
 };
 
 typedef std::pair<uint32_t, float> MorphTargetIndexWeight;
@@ -238,6 +503,7 @@ struct WeightsAnimationTrack {
     std::vector<MorphTargetIndexWeight> activeValues;
 
     uint32_t frameCount = 0;
+    uint32_t keyCursor = 0; // the last found key
     AnimationTrackType type = AnimationTrackType::Linear;
 };
 
@@ -247,11 +513,11 @@ struct WeightTrackMorphMeshIndex {
 };
 
 struct Animation {
-    std::vector<SceneNode> sceneNodes;
-    std::vector<SceneNode*> dynamicNodes;
-    std::vector<VectorAnimationTrack> positionTracks;
-    std::vector<QuatAnimationTrack> rotationTracks;
-    std::vector<VectorAnimationTrack> scaleTracks;
+    std::vector<uint32_t> dynamicNodes; // sorted, in "Scene::sceneNodes"
+    std::vector<AnimationTrackGroup> trackGroups;
+    std::vector<float> keys;
+    std::vector<float> values;
+    std::vector<uint16_t> quantizedValues;
     std::vector<WeightsAnimationTrack> weightTracks;
     std::vector<WeightTrackMorphMeshIndex> morphMeshInstances;
     std::string name;
@@ -261,6 +527,21 @@ struct Animation {
     float animationTimeSec = 0.0f;
 };
 
+// A clip played by "AnimationActor", weights are normalized across clips of the actor
+struct AnimationClipState {
+    uint32_t animationIndex = InvalidIndex; // "InvalidIndex" - unused
+    float timeSec = 0.0f;                   // looped
+    float speed = 1.0f;
+    float weight = 1.0f;
+    std::vector<uint32_t> keyCursors; // per "Animation::trackGroups" entry, any values are valid (only a lookup hint)
+};
+
+// An independent copy of the animated hierarchy, nodes not affected by the clips keep the "Scene::sceneNodes" state
+struct AnimationActor {
+    AnimationClipState clips[4];
+    std::vector<float4x4> worldTransforms; // the pose, per "Scene::sceneNodes" entry
+};
+
 struct Scene {
     ~Scene() {
         UnloadTextureData();
@@ -269,31 +550,48 @@ struct Scene {
     // Transient resources - texture & geometry data (can be unloaded after uploading on GPU)
     std::vector<utils::Texture*> textures;
     std::vector<Vertex> vertices;
+    std::vector<CompactVertex> compactVertices; // only if "LoadSceneDesc::generateCompactVertices" is set, indexed as "vertices"
+    std::vector<VertexPosition> vertexPositions; // only if "LoadSceneDesc::generateVertexStreams" is set
+    std::vector<VertexAttributes> vertexAttributes;
     std::vector<UnpackedVertex> unpackedVertices;
     std::vector<Index> indices;
+    std::vector<uint16_t> indices16;
     std::vector<Primitive> primitives;
     std::vector<MorphVertex> morphVertices;
+    std::vector<MorphTarget> morphTargets; // only if "LoadSceneDesc::sparseMorphTargets" is set
+    std::vector<MorphDelta> morphDeltas;
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshletVertices; // relative to "Mesh::vertexOffset"
+    std::vector<uint8_t> meshletPrimitives; // 3 indices per primitive, relative to "Meshlet::vertexOffset"
 
     // Other resources
     std::vector<Material> materials;
     std::vector<Instance> instances;
     std::vector<Mesh> meshes;
+    std::vector<MeshLod> meshLods;
     std::vector<MeshInstance> meshInstances;
     std::vector<Animation> animations;
+    std::vector<SceneNode> sceneNodes; // shared by all animations
     std::vector<uint32_t> morphMeshes;
     float4x4 mSceneToWorld = float4x4::Identity();
     cBoxf aabb;
+    TextureStreamer* textureStreamer = nullptr; // "LoadSceneDesc::textureStreamer", "textures" get unregistered from it on unload
 
     uint32_t totalInstancedPrimitivesNum = 0;
     uint32_t morphIndexNum = 0;
     uint32_t morphVertexNum = 0;
     uint32_t morphPrimitiveNum = 0;
 
-    void Animate(float animationSpeed, float elapsedTime, float& animationProgress, uint32_t animationIndex);
+    // "updatedInstanceIndices" (optional) gets indices of instances with changed transforms
+    void Animate(float animationSpeed, float elapsedTime, float& animationProgress, uint32_t animationIndex, std::vector<uint32_t>* updatedInstanceIndices = nullptr);
 
     inline void UnloadTextureData() {
-        for (auto texture : textures)
+        for (auto texture : textures) {
+            if (textureStreamer)
+                textureStreamer->Unregister(*texture);
+
             delete texture;
+        }
 
         textures.resize(0);
         textures.shrink_to_fit();
@@ -303,17 +601,79 @@ struct Scene {
         vertices.resize(0);
         vertices.shrink_to_fit();
 
+        compactVertices.resize(0);
+        compactVertices.shrink_to_fit();
+
+        vertexPositions.resize(0);
+        vertexPositions.shrink_to_fit();
+
+        vertexAttributes.resize(0);
+        vertexAttributes.shrink_to_fit();
+
         unpackedVertices.resize(0);
         unpackedVertices.shrink_to_fit();
 
         indices.resize(0);
         indices.shrink_to_fit();
 
+        indices16.resize(0);
+        indices16.shrink_to_fit();
+
         primitives.resize(0);
         primitives.shrink_to_fit();
 
         morphVertices.resize(0);
         morphVertices.shrink_to_fit();
+
+        morphTargets.resize(0);
+        morphTargets.shrink_to_fit();
+
+        morphDeltas.resize(0);
+        morphDeltas.shrink_to_fit();
+
+        meshlets.resize(0);
+        meshlets.shrink_to_fit();
+
+        meshletVertices.resize(0);
+        meshletVertices.shrink_to_fit();
+
+        meshletPrimitives.resize(0);
+        meshletPrimitives.shrink_to_fit();
+    }
+};
+
+struct InstanceBvhNode {
+    float aabbMin[3];
+    uint32_t offset; // first child (the second one follows) or first item in the leaf
+    float aabbMax[3];
+    uint32_t num; // "0" for inner nodes
+};
+
+// "instanceIndex" and "hitDistance" of an instance, which world AABB is hit closer than the current closest hit. Return "false" to reject the hit
+// or refine "hitDistance" (for example, using triangles of the mesh)
+typedef std::function<bool(uint32_t instanceIndex, float& hitDistance)> InstanceBvhRayCallback;
+
+// SAH BVH over world AABBs of "Scene::instances" (world space, "Instance::position" included)
+class InstanceBvh {
+public:
+    void Build(const Scene& scene); // instances of empty meshes (skipped primitives) are not added
+    bool Refit(const Scene& scene); // updates boxes of instances with "allowUpdate" (for example, after "Scene::Animate"), "false" if "Build" is needed
+
+    bool CastRay(const float3& origin, const float3& direction, float maxDistance, uint32_t& instanceIndex, float& hitDistance, const InstanceBvhRayCallback& callback = nullptr) const; // closest hit
+    void OverlapBox(const cBoxf& aabb, std::vector<uint32_t>& instanceIndices) const;                                                                                                         // appends
+    void OverlapSphere(const float3& center, float radius, std::vector<uint32_t>& instanceIndices) const;                                                                                    // appends
+
+    inline const std::vector<InstanceBvhNode>& GetNodes() const {
+        return m_Nodes;
     }
+
+    inline const cBoxf& GetInstanceAabb(uint32_t instanceIndex) const {
+        return m_InstanceAabbs[instanceIndex];
+    }
+
+private:
+    std::vector<InstanceBvhNode> m_Nodes;
+    std::vector<uint32_t> m_Items; // instance indices referenced by leaves
+    std::vector<cBoxf> m_InstanceAabbs;
 };
 } // namespace utils
@@ -0,0 +1,44 @@
+// © 2021 NVIDIA Corporation
+
+// Decoding of "utils::CompactVertex", "data" is the vertex as "uint4" (for example, "buffer.Load4(vertexIndex * 16)")
+
+#ifndef NRI_FRAMEWORK_UTILS_HLSLI
+#define NRI_FRAMEWORK_UTILS_HLSLI
+
+float3 CompactVertex_DecodeOctahedral(float2 e) {
+    e = e * 2.0 - 1.0;
+
+    float3 v = float3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    float t = saturate(-v.z);
+    v.x += v.x >= 0.0 ? -t : t;
+    v.y += v.y >= 0.0 ? -t : t;
+
+    return normalize(v);
+}
+
+// "scale" and "bias" - "utils::Mesh::GetPositionScale()" and "utils::Mesh::GetPositionBias()"
+float3 CompactVertex_GetPosition(uint4 data, float3 scale, float3 bias) {
+    float3 pos = float3(data.x & 0xFFFF, data.x >> 16, data.y & 0xFFFF) / 65535.0;
+
+    return bias + pos * scale;
+}
+
+float3 CompactVertex_GetNormal(uint4 data) {
+    float2 e = float2(data.z & 0xFFFF, data.z >> 16) / 65535.0;
+
+    return CompactVertex_DecodeOctahedral(e);
+}
+
+// ".w" - handedness
+float4 CompactVertex_GetTangent(uint4 data) {
+    uint T = data.y >> 16;
+    float2 e = float2(T & 0xFF, (T >> 8) & 0x7F) / float2(255.0, 127.0);
+
+    return float4(CompactVertex_DecodeOctahedral(e), (T & 0x8000) ? -1.0 : 1.0);
+}
+
+float2 CompactVertex_GetUv(uint4 data) {
+    return f16tof32(uint2(data.w & 0xFFFF, data.w >> 16));
+}
+
+#endif
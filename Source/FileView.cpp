@@ -0,0 +1,194 @@
+// © 2021 NVIDIA Corporation
+
+#if _WIN32
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include "NRIFramework.h"
+
+utils::FileView::FileView(FileView&& other) noexcept {
+    *this = std::move(other);
+}
+
+utils::FileView& utils::FileView::operator=(FileView&& other) noexcept {
+    if (this != &other) {
+        Close();
+
+        m_Data = other.m_Data;
+        m_Size = other.m_Size;
+        m_IsMapped = other.m_IsMapped;
+        m_IsOpen = other.m_IsOpen;
+
+        other.m_Data = nullptr;
+        other.m_Size = 0;
+        other.m_IsMapped = false;
+        other.m_IsOpen = false;
+    }
+
+    return *this;
+}
+
+utils::FileView::~FileView() {
+    Close();
+}
+
+bool utils::FileView::Open(const std::string& path) {
+    Close();
+
+#if _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        printf("ERROR: File '%s' is not found!\n", path.c_str());
+        return false;
+    }
+
+    LARGE_INTEGER size = {};
+    GetFileSizeEx(file, &size);
+    m_Size = (size_t)size.QuadPart;
+
+    if (m_Size) {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            m_Data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); // the view keeps the mapping alive
+        }
+
+        if (m_Data)
+            m_IsMapped = true;
+        else {
+            // Fallback to reading
+            uint8_t* data = (uint8_t*)malloc(m_Size);
+            size_t readSize = 0;
+            while (data && readSize < m_Size) {
+                DWORD chunkSize = (DWORD)min(m_Size - readSize, (size_t)(1u << 30));
+                DWORD bytesRead = 0;
+                if (!ReadFile(file, data + readSize, chunkSize, &bytesRead, nullptr) || bytesRead == 0)
+                    break;
+
+                readSize += bytesRead;
+            }
+
+            if (readSize == m_Size)
+                m_Data = data;
+            else
+                free(data);
+        }
+    }
+
+    CloseHandle(file);
+#else
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        printf("ERROR: File '%s' is not found!\n", path.c_str());
+        return false;
+    }
+
+    struct stat info = {};
+    fstat(file, &info);
+    m_Size = (size_t)info.st_size;
+
+    if (m_Size) {
+        void* data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data != MAP_FAILED) {
+            m_Data = (const uint8_t*)data;
+            m_IsMapped = true;
+        } else {
+            // Fallback to reading
+            uint8_t* buffer = (uint8_t*)malloc(m_Size);
+            size_t readSize = 0;
+            while (buffer && readSize < m_Size) {
+                ssize_t bytesRead = read(file, buffer + readSize, m_Size - readSize);
+                if (bytesRead <= 0)
+                    break;
+
+                readSize += (size_t)bytesRead;
+            }
+
+            if (readSize == m_Size)
+                m_Data = buffer;
+            else
+                free(buffer);
+        }
+    }
+
+    close(file);
+#endif
+
+    // An empty file is an open, empty view
+    if (m_Size && !m_Data) {
+        printf("ERROR: Can't read file '%s'!\n", path.c_str());
+        m_Size = 0;
+
+        return false;
+    }
+
+    m_IsOpen = true;
+
+    return true;
+}
+
+void utils::FileView::Close() {
+    m_IsOpen = false;
+
+    if (!m_Data)
+        return;
+
+    if (m_IsMapped) {
+#if _WIN32
+        UnmapViewOfFile(m_Data);
+#else
+        munmap((void*)m_Data, m_Size);
+#endif
+    } else
+        free((void*)m_Data);
+
+    m_Data = nullptr;
+    m_Size = 0;
+    m_IsMapped = false;
+}
+
+void utils::FileView::Prefetch(const uint8_t* data, size_t size) const {
+    if (!m_IsMapped || !size)
+        return;
+
+#if _WIN32
+    WIN32_MEMORY_RANGE_ENTRY range = {(void*)data, size};
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    // "madvise" needs a page aligned address
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)data & ~(pageSize - 1);
+
+    madvise((void*)begin, (uintptr_t)data + size - begin, MADV_WILLNEED);
+#endif
+}
+
+void utils::FileView::Discard(const uint8_t* data, size_t size) const {
+    if (!m_IsMapped || !size)
+        return;
+
+#if _WIN32
+    uintptr_t pageSize = 4096;
+#else
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+#endif
+
+    // Only whole pages, since neighboring data can share boundary pages
+    uintptr_t begin = ((uintptr_t)data + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t end = ((uintptr_t)data + size) & ~(pageSize - 1);
+    if (begin >= end)
+        return;
+
+#if _WIN32
+    // Removes pages from the working set, since they are not locked
+    VirtualUnlock((void*)begin, end - begin);
+#else
+    // Pages are clean (read-only mapping), they get reloaded from the file if accessed again
+    madvise((void*)begin, end - begin, MADV_DONTNEED);
+#endif
+}
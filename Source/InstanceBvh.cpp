@@ -0,0 +1,409 @@
+// © 2021 NVIDIA Corporation
+
+#include "NRIFramework.h"
+
+#include <algorithm>
+#include <cfloat>
+
+constexpr uint32_t BVH_BIN_NUM = 16;
+constexpr uint32_t BVH_MAX_LEAF_ITEM_NUM = 4;
+constexpr uint32_t BVH_MAX_SAH_DEPTH = 64; // deeper nodes get split by the median, it keeps traversal stacks bounded
+constexpr uint32_t BVH_STACK_SIZE = 128;
+
+static inline float GetComponent(const float3& v, uint32_t axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+static inline float3 GetNodeMin(const utils::InstanceBvhNode& node) {
+    return float3(node.aabbMin[0], node.aabbMin[1], node.aabbMin[2]);
+}
+
+static inline float3 GetNodeMax(const utils::InstanceBvhNode& node) {
+    return float3(node.aabbMax[0], node.aabbMax[1], node.aabbMax[2]);
+}
+
+static inline void SetNodeAabb(utils::InstanceBvhNode& node, const cBoxf& aabb) {
+    node.aabbMin[0] = aabb.vMin.x;
+    node.aabbMin[1] = aabb.vMin.y;
+    node.aabbMin[2] = aabb.vMin.z;
+    node.aabbMax[0] = aabb.vMax.x;
+    node.aabbMax[1] = aabb.vMax.y;
+    node.aabbMax[2] = aabb.vMax.z;
+}
+
+static inline bool IsEmpty(const cBoxf& aabb) {
+    return !(aabb.vMin.x <= aabb.vMax.x); // also "true" for NaNs
+}
+
+static inline float GetHalfArea(const cBoxf& aabb) {
+    float3 d = aabb.vMax - aabb.vMin;
+    if (d.x < 0.0f || d.y < 0.0f || d.z < 0.0f)
+        return 0.0f;
+
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// Entry distance or "FLT_MAX" if missed
+static inline float IntersectRay(const float3& aabbMin, const float3& aabbMax, const float3& origin, const float3& invDirection) {
+    if (aabbMin.x > aabbMax.x) // empty
+        return FLT_MAX;
+
+    float3 t0 = (aabbMin - origin) * invDirection;
+    float3 t1 = (aabbMax - origin) * invDirection;
+
+    float tmin = max(max(min(t0.x, t1.x), min(t0.y, t1.y)), max(min(t0.z, t1.z), 0.0f));
+    float tmax = min(min(max(t0.x, t1.x), max(t0.y, t1.y)), max(t0.z, t1.z));
+
+    return tmin <= tmax ? tmin : FLT_MAX;
+}
+
+static inline bool OverlapsBox(const float3& aabbMin, const float3& aabbMax, const cBoxf& aabb) {
+    return aabbMin.x <= aabb.vMax.x && aabbMin.y <= aabb.vMax.y && aabbMin.z <= aabb.vMax.z && aabbMax.x >= aabb.vMin.x && aabbMax.y >= aabb.vMin.y && aabbMax.z >= aabb.vMin.z;
+}
+
+static inline bool OverlapsSphere(const float3& aabbMin, const float3& aabbMax, const float3& center, float radiusSq) {
+    float dx = max(max(aabbMin.x - center.x, center.x - aabbMax.x), 0.0f);
+    float dy = max(max(aabbMin.y - center.y, center.y - aabbMax.y), 0.0f);
+    float dz = max(max(aabbMin.z - center.z, center.z - aabbMax.z), 0.0f);
+
+    return dx * dx + dy * dy + dz * dz <= radiusSq;
+}
+
+static void ComputeInstanceAabb(const utils::Scene& scene, const utils::Instance& instance, cBoxf& aabb) {
+    const utils::Mesh& mesh = scene.meshes[scene.meshInstances[instance.meshInstanceIndex].meshIndex];
+    if (!mesh.vertexNum) {
+        aabb.Clear();
+        return;
+    }
+
+    TransformAabb(instance.rotation, mesh.aabb, aabb);
+
+    float3 position = float3(instance.position);
+    aabb.vMin += position;
+    aabb.vMax += position;
+}
+
+void utils::InstanceBvh::Build(const Scene& scene) {
+    uint32_t instanceNum = (uint32_t)scene.instances.size();
+
+    m_InstanceAabbs.resize(instanceNum);
+    ParallelFor(instanceNum, 1024, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t i = begin; i < end; i++)
+            ComputeInstanceAabb(scene, scene.instances[i], m_InstanceAabbs[i]);
+    });
+
+    // Instances of empty meshes have no valid centroids and are never hit, they are not added
+    m_Items.clear();
+    m_Items.reserve(instanceNum);
+    for (uint32_t i = 0; i < instanceNum; i++) {
+        if (!IsEmpty(m_InstanceAabbs[i]))
+            m_Items.push_back(i);
+    }
+
+    m_Nodes.clear();
+
+    uint32_t itemNum = (uint32_t)m_Items.size();
+    if (!itemNum)
+        return;
+
+    std::vector<float3> centroids(instanceNum);
+    for (uint32_t item : m_Items)
+        centroids[item] = m_InstanceAabbs[item].GetCenter();
+
+    // Each leaf has at least 1 item, i.e. there are at most "2 * N - 1" nodes
+    m_Nodes.reserve(itemNum * 2);
+
+    InstanceBvhNode& root = m_Nodes.emplace_back();
+    root.offset = 0;
+    root.num = itemNum;
+
+    std::vector<std::pair<uint32_t, uint32_t>> stack; // node index, depth
+    stack.push_back({0, 0});
+
+    while (!stack.empty()) {
+        uint32_t nodeIndex = stack.back().first;
+        uint32_t depth = stack.back().second;
+        stack.pop_back();
+
+        uint32_t first = m_Nodes[nodeIndex].offset;
+        uint32_t num = m_Nodes[nodeIndex].num;
+
+        cBoxf aabb;
+        cBoxf centroidAabb;
+        for (uint32_t i = first; i < first + num; i++) {
+            aabb.Add(m_InstanceAabbs[m_Items[i]]);
+            centroidAabb.Add(centroids[m_Items[i]]);
+        }
+
+        SetNodeAabb(m_Nodes[nodeIndex], aabb);
+
+        if (num <= BVH_MAX_LEAF_ITEM_NUM)
+            continue;
+
+        // Binned SAH
+        uint32_t bestAxis = InvalidIndex;
+        uint32_t bestBin = 0;
+        float bestCost = FLT_MAX;
+
+        if (depth < BVH_MAX_SAH_DEPTH) {
+            for (uint32_t axis = 0; axis < 3; axis++) {
+                float centroidMin = GetComponent(centroidAabb.vMin, axis);
+                float extent = GetComponent(centroidAabb.vMax, axis) - centroidMin;
+                if (extent <= 0.0f)
+                    continue;
+
+                cBoxf binAabbs[BVH_BIN_NUM];
+                uint32_t binItemNums[BVH_BIN_NUM] = {};
+
+                float scale = BVH_BIN_NUM / extent;
+                for (uint32_t i = first; i < first + num; i++) {
+                    uint32_t bin = min((uint32_t)((GetComponent(centroids[m_Items[i]], axis) - centroidMin) * scale), BVH_BIN_NUM - 1);
+
+                    binAabbs[bin].Add(m_InstanceAabbs[m_Items[i]]);
+                    binItemNums[bin]++;
+                }
+
+                // Costs of splits after each bin (the cost of traversal is "1" in units of "half area * item num")
+                float leftAreas[BVH_BIN_NUM - 1];
+                uint32_t leftNums[BVH_BIN_NUM - 1];
+
+                cBoxf leftAabb;
+                uint32_t leftNum = 0;
+                for (uint32_t i = 0; i < BVH_BIN_NUM - 1; i++) {
+                    leftAabb.Add(binAabbs[i]);
+                    leftNum += binItemNums[i];
+
+                    leftAreas[i] = GetHalfArea(leftAabb);
+                    leftNums[i] = leftNum;
+                }
+
+                cBoxf rightAabb;
+                uint32_t rightNum = 0;
+                for (uint32_t i = BVH_BIN_NUM - 1; i > 0; i--) {
+                    rightAabb.Add(binAabbs[i]);
+                    rightNum += binItemNums[i];
+
+                    if (!leftNums[i - 1] || !rightNum)
+                        continue;
+
+                    float cost = leftAreas[i - 1] * leftNums[i - 1] + GetHalfArea(rightAabb) * rightNum;
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = i;
+                    }
+                }
+            }
+        }
+
+        uint32_t* items = m_Items.data();
+        uint32_t mid = first;
+
+        if (bestAxis != InvalidIndex) {
+            float centroidMin = GetComponent(centroidAabb.vMin, bestAxis);
+            float scale = BVH_BIN_NUM / (GetComponent(centroidAabb.vMax, bestAxis) - centroidMin);
+
+            mid = (uint32_t)(std::partition(items + first, items + first + num, [&](uint32_t item) {
+                uint32_t bin = min((uint32_t)((GetComponent(centroids[item], bestAxis) - centroidMin) * scale), BVH_BIN_NUM - 1);
+                return bin < bestBin;
+            }) - items);
+        }
+
+        // Median split along the longest centroid extent (also handles coincident centroids)
+        if (mid == first || mid == first + num) {
+            float3 extent = centroidAabb.vMax - centroidAabb.vMin;
+            uint32_t axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+            mid = first + num / 2;
+            std::nth_element(items + first, items + mid, items + first + num, [&](uint32_t a, uint32_t b) {
+                return GetComponent(centroids[a], axis) < GetComponent(centroids[b], axis);
+            });
+        }
+
+        // Children
+        uint32_t childIndex = (uint32_t)m_Nodes.size();
+        m_Nodes.resize(m_Nodes.size() + 2);
+
+        m_Nodes[nodeIndex].offset = childIndex;
+        m_Nodes[nodeIndex].num = 0;
+
+        m_Nodes[childIndex].offset = first;
+        m_Nodes[childIndex].num = mid - first;
+        m_Nodes[childIndex + 1].offset = mid;
+        m_Nodes[childIndex + 1].num = first + num - mid;
+
+        stack.push_back({childIndex, depth + 1});
+        stack.push_back({childIndex + 1, depth + 1});
+    }
+}
+
+bool utils::InstanceBvh::Refit(const Scene& scene) {
+    if (scene.instances.size() != m_InstanceAabbs.size())
+        return false;
+
+    uint32_t instanceNum = (uint32_t)scene.instances.size();
+    ParallelFor(instanceNum, 1024, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t i = begin; i < end; i++) {
+            const Instance& instance = scene.instances[i];
+            if (instance.allowUpdate)
+                ComputeInstanceAabb(scene, instance, m_InstanceAabbs[i]);
+        }
+    });
+
+    // Children always follow parents
+    for (uint32_t i = (uint32_t)m_Nodes.size(); i > 0; i--) {
+        InstanceBvhNode& node = m_Nodes[i - 1];
+
+        cBoxf aabb;
+        if (node.num) {
+            for (uint32_t j = node.offset; j < node.offset + node.num; j++) {
+                const cBoxf& instanceAabb = m_InstanceAabbs[m_Items[j]];
+                if (!IsEmpty(instanceAabb))
+                    aabb.Add(instanceAabb);
+            }
+        } else {
+            for (uint32_t j = node.offset; j < node.offset + 2; j++) {
+                const InstanceBvhNode& child = m_Nodes[j];
+
+                cBoxf childAabb;
+                childAabb.vMin = GetNodeMin(child);
+                childAabb.vMax = GetNodeMax(child);
+
+                aabb.Add(childAabb);
+            }
+        }
+
+        SetNodeAabb(node, aabb);
+    }
+
+    return true;
+}
+
+bool utils::InstanceBvh::CastRay(const float3& origin, const float3& direction, float maxDistance, uint32_t& instanceIndex, float& hitDistance, const InstanceBvhRayCallback& callback) const {
+    instanceIndex = InvalidIndex;
+    hitDistance = maxDistance;
+
+    if (m_Nodes.empty())
+        return false;
+
+    float3 invDirection;
+    invDirection.x = 1.0f / (abs(direction.x) > 1e-20f ? direction.x : (direction.x < 0.0f ? -1e-20f : 1e-20f));
+    invDirection.y = 1.0f / (abs(direction.y) > 1e-20f ? direction.y : (direction.y < 0.0f ? -1e-20f : 1e-20f));
+    invDirection.z = 1.0f / (abs(direction.z) > 1e-20f ? direction.z : (direction.z < 0.0f ? -1e-20f : 1e-20f));
+
+    uint32_t stack[BVH_STACK_SIZE];
+    float stackDistances[BVH_STACK_SIZE];
+    uint32_t stackSize = 0;
+
+    float rootDistance = IntersectRay(GetNodeMin(m_Nodes[0]), GetNodeMax(m_Nodes[0]), origin, invDirection);
+    if (rootDistance < hitDistance) {
+        stack[stackSize] = 0;
+        stackDistances[stackSize++] = rootDistance;
+    }
+
+    while (stackSize) {
+        stackSize--;
+        if (stackDistances[stackSize] >= hitDistance)
+            continue;
+
+        const InstanceBvhNode& node = m_Nodes[stack[stackSize]];
+        if (node.num) {
+            for (uint32_t i = node.offset; i < node.offset + node.num; i++) {
+                uint32_t item = m_Items[i];
+                const cBoxf& aabb = m_InstanceAabbs[item];
+
+                float distance = IntersectRay(aabb.vMin, aabb.vMax, origin, invDirection);
+                if (distance >= hitDistance)
+                    continue;
+
+                if (callback && !callback(item, distance))
+                    continue;
+
+                if (distance < hitDistance) {
+                    hitDistance = distance;
+                    instanceIndex = item;
+                }
+            }
+        } else {
+            const InstanceBvhNode& child0 = m_Nodes[node.offset];
+            const InstanceBvhNode& child1 = m_Nodes[node.offset + 1];
+
+            float distance0 = IntersectRay(GetNodeMin(child0), GetNodeMax(child0), origin, invDirection);
+            float distance1 = IntersectRay(GetNodeMin(child1), GetNodeMax(child1), origin, invDirection);
+
+            // The nearest child goes last to be visited first
+            uint32_t nearIndex = node.offset;
+            uint32_t farIndex = node.offset + 1;
+            if (distance1 < distance0) {
+                std::swap(nearIndex, farIndex);
+                std::swap(distance0, distance1);
+            }
+
+            if (distance1 < hitDistance) {
+                stack[stackSize] = farIndex;
+                stackDistances[stackSize++] = distance1;
+            }
+
+            if (distance0 < hitDistance) {
+                stack[stackSize] = nearIndex;
+                stackDistances[stackSize++] = distance0;
+            }
+        }
+    }
+
+    return instanceIndex != InvalidIndex;
+}
+
+void utils::InstanceBvh::OverlapBox(const cBoxf& aabb, std::vector<uint32_t>& instanceIndices) const {
+    if (m_Nodes.empty())
+        return;
+
+    uint32_t stack[BVH_STACK_SIZE];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize) {
+        const InstanceBvhNode& node = m_Nodes[stack[--stackSize]];
+        if (!OverlapsBox(GetNodeMin(node), GetNodeMax(node), aabb))
+            continue;
+
+        if (node.num) {
+            for (uint32_t i = node.offset; i < node.offset + node.num; i++) {
+                uint32_t item = m_Items[i];
+                if (OverlapsBox(m_InstanceAabbs[item].vMin, m_InstanceAabbs[item].vMax, aabb))
+                    instanceIndices.push_back(item);
+            }
+        } else {
+            stack[stackSize++] = node.offset;
+            stack[stackSize++] = node.offset + 1;
+        }
+    }
+}
+
+void utils::InstanceBvh::OverlapSphere(const float3& center, float radius, std::vector<uint32_t>& instanceIndices) const {
+    if (m_Nodes.empty())
+        return;
+
+    float radiusSq = radius * radius;
+
+    uint32_t stack[BVH_STACK_SIZE];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize) {
+        const InstanceBvhNode& node = m_Nodes[stack[--stackSize]];
+        if (!OverlapsSphere(GetNodeMin(node), GetNodeMax(node), center, radiusSq))
+            continue;
+
+        if (node.num) {
+            for (uint32_t i = node.offset; i < node.offset + node.num; i++) {
+                uint32_t item = m_Items[i];
+                if (OverlapsSphere(m_InstanceAabbs[item].vMin, m_InstanceAabbs[item].vMax, center, radiusSq))
+                    instanceIndices.push_back(item);
+            }
+        } else {
+            stack[stackSize++] = node.offset;
+            stack[stackSize++] = node.offset + 1;
+        }
+    }
+}
@@ -575,6 +575,10 @@ bool SampleBase::Create(int32_t argc, char** argv, const char* windowTitle) {
     m_NRIWindow.metal.caMetalLayer = GetMetalLayer(m_Window);
 #endif
 
+    // Shader bundle, "LoadShader" maps it on first use
+    if (m_ShaderBundle)
+        utils::CreateShaderBundle(graphicsAPI);
+
     // Main initialization
     printf("Loading...\n");
 
@@ -711,6 +715,7 @@ void SampleBase::InitCmdLineDefault(cmdline::parser& cmdLine) {
     cmdLine.add("debugAPI", 0, "enable graphics API validation layer");
     cmdLine.add("debugNRI", 0, "enable NRI validation layer");
     cmdLine.add("alwaysActive", 0, "continue to render if not in focus");
+    cmdLine.add("shaderBundle", 0, "pack compiled shaders of the selected API into a bundle loaded by this and next runs (repeat after recompilation)");
 }
 
 void SampleBase::ReadCmdLineDefault(cmdline::parser& cmdLine) {
@@ -724,6 +729,7 @@ void SampleBase::ReadCmdLineDefault(cmdline::parser& cmdLine) {
     m_DebugAPI = cmdLine.exist("debugAPI");
     m_DebugNRI = cmdLine.exist("debugNRI");
     m_AlwaysActive = cmdLine.exist("alwaysActive");
+    m_ShaderBundle = cmdLine.exist("shaderBundle");
 }
 
 void SampleBase::EnableMemoryLeakDetection([[maybe_unused]] uint32_t breakOnAllocationIndex) {
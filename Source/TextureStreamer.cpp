@@ -0,0 +1,157 @@
+// © 2021 NVIDIA Corporation
+
+#include "NRIFramework.h"
+
+#include <algorithm>
+
+#include "Detex/detex.h"
+
+constexpr size_t PAGE_TOUCH_STRIDE = 4096; // the smallest page size
+
+static const uint8_t* GetMipData(const utils::Texture& texture, uint32_t mipIndex) {
+    return ((detexTexture**)texture.mips)[mipIndex]->data;
+}
+
+static void DiscardMip(const utils::Texture& texture, uint32_t mipIndex) {
+    texture.file.Discard(GetMipData(texture, mipIndex), texture.GetMipSize(mipIndex));
+}
+
+void utils::TextureStreamer::Register(Texture& texture) {
+    // Heap allocated mips (KTX, PNG, the "read" fallback) can't be discarded
+    if (!texture.mipNum || !texture.file.IsMapped())
+        return;
+
+    // Tail mips are always resident
+    uint32_t tailMipOffset = texture.mipNum - 1u;
+    for (uint32_t i = 0; i < texture.mipNum; i++) {
+        uint32_t w = max(texture.width >> i, 1);
+        uint32_t h = max(texture.height >> i, 1);
+        if (max(w, h) <= m_Desc.tailMipSize) {
+            tailMipOffset = i;
+            break;
+        }
+    }
+
+    texture.lastUseFrame = 0;
+    texture.tailMipOffset = (uint8_t)tailMipOffset;
+    texture.requestedMipOffset = (uint8_t)tailMipOffset;
+    texture.residentMipOffset = (uint8_t)tailMipOffset;
+
+    // Loading could have touched finer mips
+    for (uint32_t i = 0; i < tailMipOffset; i++)
+        DiscardMip(texture, i);
+
+    for (uint32_t i = tailMipOffset; i < texture.mipNum; i++)
+        m_ResidentSize += texture.GetMipSize(i);
+
+    m_Textures.push_back(&texture);
+}
+
+void utils::TextureStreamer::Unregister(Texture& texture) {
+    auto it = std::find(m_Textures.begin(), m_Textures.end(), &texture);
+    if (it == m_Textures.end())
+        return;
+
+    m_Textures.erase(it);
+    m_ChangedTextures.erase(std::remove(m_ChangedTextures.begin(), m_ChangedTextures.end(), &texture), m_ChangedTextures.end());
+    m_PagedInMips.erase(std::remove_if(m_PagedInMips.begin(), m_PagedInMips.end(), [&texture](const auto& pagedInMip) { return pagedInMip.first == &texture; }), m_PagedInMips.end());
+
+    for (uint32_t i = texture.residentMipOffset; i < texture.mipNum; i++)
+        m_ResidentSize -= texture.GetMipSize(i);
+
+    // Not streamed anymore, i.e. all mips are accessible (pages are loaded on demand)
+    texture.tailMipOffset = 0;
+    texture.requestedMipOffset = 0;
+    texture.residentMipOffset = 0;
+}
+
+void utils::TextureStreamer::Request(Texture& texture, uint32_t mipIndex) {
+    uint8_t requestedMipOffset = (uint8_t)min(mipIndex, (uint32_t)texture.tailMipOffset);
+
+    // The finest mip requested during the last frame the texture was used in
+    if (texture.lastUseFrame == m_FrameIndex)
+        texture.requestedMipOffset = min(texture.requestedMipOffset, requestedMipOffset);
+    else
+        texture.requestedMipOffset = requestedMipOffset;
+
+    texture.lastUseFrame = m_FrameIndex;
+}
+
+const std::vector<utils::Texture*>& utils::TextureStreamer::Update() {
+    // Mips paged in by the previous "Update" have been uploaded, release their pages
+    for (const auto& [texture, mipIndex] : m_PagedInMips)
+        DiscardMip(*texture, mipIndex);
+
+    m_PagedInMips.clear();
+    m_ChangedTextures.clear();
+
+    // Tails are resident anyway
+    uint64_t gpuMemoryBudget = m_Desc.gpuMemoryBudget;
+    for (const Texture* texture : m_Textures) {
+        for (uint32_t i = texture->tailMipOffset; i < texture->mipNum; i++)
+            gpuMemoryBudget -= min((uint64_t)texture->GetMipSize(i), gpuMemoryBudget);
+    }
+
+    // Most recently used textures get their requested mips first, the least recently used ones get evicted
+    std::stable_sort(m_Textures.begin(), m_Textures.end(), [](const Texture* a, const Texture* b) { return a->lastUseFrame > b->lastUseFrame; });
+
+    uint64_t pageInSize = 0;
+    for (Texture* texture : m_Textures) {
+        // Walk from coarse to fine mips while they fit into budgets (resident ones don't need paging)
+        uint32_t mipOffset = texture->tailMipOffset;
+        while (mipOffset > texture->requestedMipOffset) {
+            uint64_t mipSize = texture->GetMipSize(mipOffset - 1);
+            if (mipSize > gpuMemoryBudget)
+                break;
+
+            bool isResident = mipOffset - 1 >= texture->residentMipOffset;
+            if (!isResident) {
+                if (pageInSize + mipSize > m_Desc.cpuMemoryBudget)
+                    break;
+
+                pageInSize += mipSize;
+            }
+
+            gpuMemoryBudget -= mipSize;
+            mipOffset--;
+        }
+
+        if (mipOffset == texture->residentMipOffset)
+            continue;
+
+        if (mipOffset < texture->residentMipOffset) {
+            for (uint32_t i = mipOffset; i < texture->residentMipOffset; i++) {
+                m_PagedInMips.push_back({texture, i});
+                m_ResidentSize += texture->GetMipSize(i);
+            }
+        } else {
+            for (uint32_t i = texture->residentMipOffset; i < mipOffset; i++) {
+                DiscardMip(*texture, i);
+                m_ResidentSize -= texture->GetMipSize(i);
+            }
+        }
+
+        texture->residentMipOffset = (uint8_t)mipOffset;
+        m_ChangedTextures.push_back(texture);
+    }
+
+    // Page in, i.e. make sure that uploading doesn't hit page faults
+    ParallelFor((uint32_t)m_PagedInMips.size(), 1, [this](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t i = begin; i < end; i++) {
+            const Texture& texture = *m_PagedInMips[i].first;
+            uint32_t mipIndex = m_PagedInMips[i].second;
+
+            const uint8_t* data = GetMipData(texture, mipIndex);
+            size_t size = texture.GetMipSize(mipIndex);
+            texture.file.Prefetch(data, size);
+
+            const volatile uint8_t* pages = data;
+            for (size_t j = 0; j < size; j += PAGE_TOUCH_STRIDE)
+                (void)pages[j];
+        }
+    });
+
+    m_FrameIndex++;
+
+    return m_ChangedTextures;
+}
@@ -0,0 +1,146 @@
+// © 2021 NVIDIA Corporation
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "NRIFramework.h"
+
+struct ParallelJob {
+    const utils::ParallelForCallback* callback = nullptr;
+    std::atomic_uint32_t next = 0;
+    uint32_t num = 0;
+    uint32_t grainSize = 1;
+    uint32_t activeThreadNum = 0; // protected by the pool mutex
+};
+
+class ThreadPool {
+public:
+    ThreadPool() {
+        // The calling thread participates too
+        uint32_t threadNum = std::thread::hardware_concurrency();
+        threadNum = threadNum > 1 ? threadNum - 1 : 0;
+
+        m_Threads.reserve(threadNum);
+        for (uint32_t i = 0; i < threadNum; i++)
+            m_Threads.emplace_back(&ThreadPool::WorkerLoop, this, i + 1);
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Quit = true;
+        }
+
+        m_JobCondition.notify_all();
+
+        for (std::thread& thread : m_Threads)
+            thread.join();
+    }
+
+    inline uint32_t GetThreadNum() const {
+        return (uint32_t)m_Threads.size() + 1;
+    }
+
+    void Run(ParallelJob& job) {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Jobs.push_back(&job);
+        }
+
+        m_JobCondition.notify_all();
+
+        Execute(job, 0);
+
+        // No new workers can join after the job is removed from the queue, wait for the active ones
+        std::unique_lock<std::mutex> lock(m_Mutex);
+
+        auto it = std::find(m_Jobs.begin(), m_Jobs.end(), &job);
+        if (it != m_Jobs.end())
+            m_Jobs.erase(it);
+
+        m_DoneCondition.wait(lock, [&job] { return job.activeThreadNum == 0; });
+    }
+
+private:
+    static void Execute(ParallelJob& job, uint32_t threadIndex) {
+        while (true) {
+            uint32_t begin = job.next.fetch_add(job.grainSize);
+            if (begin >= job.num)
+                break;
+
+            uint32_t end = min(begin + job.grainSize, job.num);
+            (*job.callback)(begin, end, threadIndex);
+        }
+    }
+
+    void WorkerLoop(uint32_t threadIndex) {
+        while (true) {
+            ParallelJob* job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_JobCondition.wait(lock, [this] { return m_Quit || !m_Jobs.empty(); });
+
+                if (m_Quit)
+                    return;
+
+                job = m_Jobs.front();
+                if (job->next >= job->num) {
+                    m_Jobs.pop_front();
+                    continue;
+                }
+
+                job->activeThreadNum++;
+            }
+
+            Execute(*job, threadIndex);
+
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                job->activeThreadNum--;
+            }
+
+            m_DoneCondition.notify_all();
+        }
+    }
+
+private:
+    std::vector<std::thread> m_Threads;
+    std::deque<ParallelJob*> m_Jobs;
+    std::mutex m_Mutex;
+    std::condition_variable m_JobCondition;
+    std::condition_variable m_DoneCondition;
+    bool m_Quit = false;
+};
+
+static ThreadPool& GetThreadPool() {
+    static ThreadPool threadPool;
+
+    return threadPool;
+}
+
+uint32_t utils::GetThreadNum() {
+    return GetThreadPool().GetThreadNum();
+}
+
+void utils::ParallelFor(uint32_t num, uint32_t grainSize, const ParallelForCallback& callback) {
+    if (num == 0)
+        return;
+
+    grainSize = max(grainSize, 1u);
+
+    ThreadPool& threadPool = GetThreadPool();
+    if (num <= grainSize || threadPool.GetThreadNum() == 1) {
+        callback(0, num, 0);
+        return;
+    }
+
+    ParallelJob job;
+    job.callback = &callback;
+    job.num = num;
+    job.grainSize = grainSize;
+
+    threadPool.Run(job);
+}
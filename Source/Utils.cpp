@@ -2,14 +2,24 @@
 
 #include "NRIFramework.h"
 
+#include <atomic>
+#include <cfloat>
 #include <filesystem>
 #include <functional>
+#include <mutex>
+#include <thread>
 
 #include "Detex/detex.h"
 
+extern "C" {
+#include "Detex/file-info.h"
+}
+
 #define CGLTF_IMPLEMENTATION
 #include "cgltf.h"
 
+#include "meshoptimizer.h"
+
 #include "Detex/stb_image.h"
 
 struct Shader {
@@ -34,417 +44,1987 @@ constexpr std::array<Shader, 13> gShaderExts = {{
 }};
 
 //========================================================================================================================
-// MISC
+// VERTEX PACKING
 //========================================================================================================================
 
-static void GenerateMorphTargetVertices(utils::Scene& scene, const utils::Mesh& mesh, uint32_t morphTargetIndex, const uint8_t* positionSrc, size_t positionStride, const uint8_t* normalSrc, size_t normalStride) {
-    std::vector<float3> tangents(mesh.vertexNum, float3::Zero());
-    std::vector<float3> bitangents(mesh.vertexNum, float3::Zero());
+// Kernels process SoA batches of 4 lanes ("_mm" intrinsics map to NEON via MathLib), strided sources are gathered per batch
+constexpr size_t VERTEX_PACKING_BATCH = 8;
 
-    for (size_t j = 0; j < mesh.indexNum; j += 3) {
-        size_t primitiveBaseIndex = mesh.indexOffset + j;
+struct SoA3 {
+    __m128 x, y, z;
+};
 
-        size_t i0 = scene.indices[primitiveBaseIndex];
-        size_t i1 = scene.indices[primitiveBaseIndex + 1];
-        size_t i2 = scene.indices[primitiveBaseIndex + 2];
+static inline __m128 Dot(const SoA3& a, const SoA3& b) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
 
-        const utils::UnpackedVertex& v0 = scene.unpackedVertices[mesh.vertexOffset + i0];
-        const utils::UnpackedVertex& v1 = scene.unpackedVertices[mesh.vertexOffset + i1];
-        const utils::UnpackedVertex& v2 = scene.unpackedVertices[mesh.vertexOffset + i2];
+static inline SoA3 Cross(const SoA3& a, const SoA3& b) {
+    return {
+        _mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+        _mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+        _mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x)),
+    };
+}
 
-        // base verts
-        float3 pb0 = v0.pos;
-        float3 pb1 = v1.pos;
-        float3 pb2 = v2.pos;
+static inline SoA3 Normalize(const SoA3& v) {
+    __m128 len = _mm_sqrt_ps(Dot(v, v));
 
-        // src morph target data is delta
-        float3 p0 = float3((float*)(positionSrc + positionStride * i0)) + pb0;
-        float3 p1 = float3((float*)(positionSrc + positionStride * i1)) + pb1;
-        float3 p2 = float3((float*)(positionSrc + positionStride * i2)) + pb2;
+    return {_mm_div_ps(v.x, len), _mm_div_ps(v.y, len), _mm_div_ps(v.z, len)};
+}
 
-        float3 uvEdge20 = float3(v2.uv[0], v2.uv[1], 0.0f) - float3(v0.uv[0], v0.uv[1], 0.0f);
-        float3 uvEdge10 = float3(v1.uv[0], v1.uv[1], 0.0f) - float3(v0.uv[0], v0.uv[1], 0.0f);
+// "mask ? b : a" (SSSE3 has no blends)
+static inline __m128 Select(__m128 a, __m128 b, __m128 mask) {
+    return _mm_or_ps(_mm_andnot_ps(mask, a), _mm_and_ps(mask, b));
+}
 
-        // base normals
-        float3 nb0 = v0.N;
-        float3 nb1 = v1.N;
-        float3 nb2 = v2.N;
+// -1, 0 or 1
+static inline __m128 Sign(__m128 v) {
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 zero = _mm_setzero_ps();
 
-        // Tangent
-        float3 n1 = float3((float*)(normalSrc + normalStride * i1)) + nb1;
-        float r = uvEdge10.x * uvEdge20.y - uvEdge20.x * uvEdge10.y;
+    return _mm_sub_ps(_mm_and_ps(_mm_cmpgt_ps(v, zero), one), _mm_and_ps(_mm_cmplt_ps(v, zero), one));
+}
 
-        float3 tangent, bitangent;
-        if (abs(r) < 1e-9f) {
-            n1.z += 1e-6f;
+// 10 10 10 2 unorm, "w" is 0
+static inline __m128i PackUnorm101010(const SoA3& v) {
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 scale = _mm_set1_ps(1023.0f);
 
-            tangent = GetPerpendicularVector(n1);
-            bitangent = cross(n1, tangent);
-        } else {
-            float invr = 1.0f / r;
+    __m128i x = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(v.x, half), half), zero), one), scale));
+    __m128i y = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(v.y, half), half), zero), one), scale));
+    __m128i z = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(v.z, half), half), zero), one), scale));
 
-            float3 a = (p1 - p0) * invr;
-            float3 b = (p2 - p0) * invr;
+    return _mm_or_si128(x, _mm_or_si128(_mm_slli_epi32(y, 10), _mm_slli_epi32(z, 20)));
+}
 
-            tangent = a * uvEdge20.y - b * uvEdge10.y;
-            bitangent = b * uvEdge10.x - a * uvEdge20.x;
-        }
+// Signed octahedral encoding, matches "Packing::EncodeUnitVector(v, true)"
+static inline void EncodeUnitVector(const SoA3& v, __m128& ex, __m128& ey) {
+    __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 one = _mm_set1_ps(1.0f);
+
+    __m128 ax = _mm_andnot_ps(signMask, v.x);
+    __m128 ay = _mm_andnot_ps(signMask, v.y);
+    __m128 az = _mm_andnot_ps(signMask, v.z);
+    __m128 invL1 = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(ax, ay), az));
+
+    __m128 x = _mm_mul_ps(v.x, invL1);
+    __m128 y = _mm_mul_ps(v.y, invL1);
+    __m128 z = _mm_mul_ps(v.z, invL1);
+
+    // Lower hemisphere is folded over the diagonals
+    __m128 signX = _mm_or_ps(_mm_and_ps(x, signMask), one);
+    __m128 signY = _mm_or_ps(_mm_and_ps(y, signMask), one);
+    __m128 wrapX = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, y)), signX);
+    __m128 wrapY = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, x)), signY);
+
+    __m128 isLower = _mm_cmplt_ps(z, _mm_setzero_ps());
+    ex = Select(x, wrapX, isLower);
+    ey = Select(y, wrapY, isLower);
+}
 
-        tangents[i0] += tangent;
-        tangents[i1] += tangent;
-        tangents[i2] += tangent;
+// 4 floats to 4 halfs in the low 64 bits
+static inline __m128i ToHalf(__m128 v) {
+#if ML_INTRINSIC_LEVEL >= ML_INTRINSIC_AVX1
+    return _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT);
+#else
+    alignas(16) float f[4];
+    alignas(16) uint16_t h[8] = {};
 
-        bitangents[i0] += bitangent;
-        bitangents[i1] += bitangent;
-        bitangents[i2] += bitangent;
+    _mm_store_ps(f, v);
+    for (uint32_t i = 0; i < 4; i++) {
+        float16_t t = float16_t(f[i]);
+        memcpy(h + i, &t, sizeof(t));
     }
 
-    uint32_t vertexOffset = mesh.morphTargetVertexOffset + morphTargetIndex * mesh.vertexNum;
-    for (size_t j = 0; j < mesh.vertexNum; j++) {
-        const utils::UnpackedVertex& v = scene.unpackedVertices[mesh.vertexOffset + j];
-        float3 pb = v.pos;
-        float3 nb = v.N;
+    return _mm_load_si128((const __m128i*)h);
+#endif
+}
 
-        float3 P = float3((float*)(positionSrc + positionStride * j)) + pb;
-        float3 N = float3((float*)(normalSrc + normalStride * j)) + nb;
-        float3 T = tangents[j];
-        if (length(T) < 1e-9f)
-            T = cross(bitangents[j], N);
-        else // Gram-Schmidt orthogonalize
-            T -= N * dot(N, T);
-        T = normalize(T);
+// Positions, normals (optional) and UVs (optional) to "Vertex" and "UnpackedVertex" (optional) streams
+static void PackVertices(const uint8_t* positionSrc, size_t positionStride, const uint8_t* normalSrc, size_t normalStride, const uint8_t* texcoordSrc, size_t texcoordStride, size_t vertexNum, utils::Vertex* vertices, utils::UnpackedVertex* unpackedVertices, cBoxf& aabb) {
+    alignas(16) float px[VERTEX_PACKING_BATCH], py[VERTEX_PACKING_BATCH], pz[VERTEX_PACKING_BATCH];
+    alignas(16) float nx[VERTEX_PACKING_BATCH], ny[VERTEX_PACKING_BATCH], nz[VERTEX_PACKING_BATCH];
+    alignas(16) float u[VERTEX_PACKING_BATCH], v[VERTEX_PACKING_BATCH];
+    alignas(16) uint32_t packedN[VERTEX_PACKING_BATCH];
+    alignas(16) uint32_t packedUv[VERTEX_PACKING_BATCH];
+
+    SoA3 boxMin = {_mm_set1_ps(FLT_MAX), _mm_set1_ps(FLT_MAX), _mm_set1_ps(FLT_MAX)};
+    SoA3 boxMax = {_mm_set1_ps(-FLT_MAX), _mm_set1_ps(-FLT_MAX), _mm_set1_ps(-FLT_MAX)};
+
+    for (size_t base = 0; base < vertexNum; base += VERTEX_PACKING_BATCH) {
+        size_t num = min(vertexNum - base, VERTEX_PACKING_BATCH);
+
+        // Gather (unused lanes replicate the last vertex to keep the bounding box valid)
+        for (size_t i = 0; i < VERTEX_PACKING_BATCH; i++) {
+            size_t j = base + min(i, num - 1);
+
+            const float* p = (const float*)(positionSrc + positionStride * j);
+            px[i] = p[0];
+            py[i] = p[1];
+            pz[i] = p[2];
+
+            if (normalSrc) {
+                const float* n = (const float*)(normalSrc + normalStride * j);
+                nx[i] = n[0];
+                ny[i] = n[1];
+                nz[i] = n[2];
+            } else {
+                nx[i] = 0.0f;
+                ny[i] = 0.0f;
+                nz[i] = 1.0f;
+            }
 
-        // Calculate handedness
-        float handedness = sign(dot(cross(N, T), bitangents[j]));
+            if (texcoordSrc) {
+                const float* t = (const float*)(texcoordSrc + texcoordStride * j);
+                u[i] = t[0];
+                v[i] = t[1];
+            } else {
+                u[i] = 0.0f;
+                v[i] = 0.0f;
+            }
+        }
 
-        // Output
-        float2 n = Packing::EncodeUnitVector(N, true);
-        float2 t = Packing::EncodeUnitVector(T, true);
+        // Pack
+        for (size_t i = 0; i < VERTEX_PACKING_BATCH; i += 4) {
+            SoA3 P = {_mm_load_ps(px + i), _mm_load_ps(py + i), _mm_load_ps(pz + i)};
+            boxMin = {_mm_min_ps(boxMin.x, P.x), _mm_min_ps(boxMin.y, P.y), _mm_min_ps(boxMin.z, P.z)};
+            boxMax = {_mm_max_ps(boxMax.x, P.x), _mm_max_ps(boxMax.y, P.y), _mm_max_ps(boxMax.z, P.z)};
 
-        utils::MorphVertex& morphVertex = scene.morphVertices[vertexOffset + j];
-        morphVertex.pos = float16_t4(float4(P.x, P.y, P.z, handedness));
-        morphVertex.N = float16_t2(float2(n.x, n.y));
-        morphVertex.T = float16_t2(float2(t.x, t.y));
-    }
-}
+            SoA3 N = {_mm_load_ps(nx + i), _mm_load_ps(ny + i), _mm_load_ps(nz + i)};
+            if (normalSrc) {
+                N = Normalize(N);
 
-static void GeneratePrimitiveDataAndTangents(utils::Scene& scene, const utils::Mesh& mesh) {
-    std::vector<float3> tangents(mesh.vertexNum, float3::Zero());
-    std::vector<float3> bitangents(mesh.vertexNum, float3::Zero());
+                _mm_store_ps(nx + i, N.x);
+                _mm_store_ps(ny + i, N.y);
+                _mm_store_ps(nz + i, N.z);
+            }
 
-    for (size_t j = 0; j < mesh.indexNum; j += 3) {
-        size_t primitiveBaseIndex = mesh.indexOffset + j;
+            _mm_store_si128((__m128i*)(packedN + i), PackUnorm101010(N));
+            _mm_store_si128((__m128i*)(packedUv + i), _mm_unpacklo_epi16(ToHalf(_mm_load_ps(u + i)), ToHalf(_mm_load_ps(v + i))));
+        }
 
-        size_t i0 = scene.indices[primitiveBaseIndex];
-        size_t i1 = scene.indices[primitiveBaseIndex + 1];
-        size_t i2 = scene.indices[primitiveBaseIndex + 2];
+        // Scatter
+        for (size_t i = 0; i < num; i++) {
+            if (unpackedVertices) {
+                utils::UnpackedVertex& unpackedVertex = unpackedVertices[base + i];
+                unpackedVertex.pos[0] = px[i];
+                unpackedVertex.pos[1] = py[i];
+                unpackedVertex.pos[2] = pz[i];
+                unpackedVertex.N[0] = nx[i];
+                unpackedVertex.N[1] = ny[i];
+                unpackedVertex.N[2] = nz[i];
+                unpackedVertex.uv[0] = u[i];
+                unpackedVertex.uv[1] = v[i];
+                // T is computed in "GeneratePrimitiveDataAndTangents"
+            }
 
-        const utils::UnpackedVertex& v0 = scene.unpackedVertices[mesh.vertexOffset + i0];
-        const utils::UnpackedVertex& v1 = scene.unpackedVertices[mesh.vertexOffset + i1];
-        const utils::UnpackedVertex& v2 = scene.unpackedVertices[mesh.vertexOffset + i2];
+            utils::Vertex& vertex = vertices[base + i];
+            vertex.pos[0] = px[i];
+            vertex.pos[1] = py[i];
+            vertex.pos[2] = pz[i];
+            vertex.N = packedN[i];
+            memcpy(&vertex.uv, packedUv + i, sizeof(vertex.uv));
+        }
+    }
 
-        float3 p0(v0.pos);
-        float3 p1(v1.pos);
-        float3 p2(v2.pos);
+    if (vertexNum) {
+        alignas(16) float minX[4], minY[4], minZ[4], maxX[4], maxY[4], maxZ[4];
+        _mm_store_ps(minX, boxMin.x);
+        _mm_store_ps(minY, boxMin.y);
+        _mm_store_ps(minZ, boxMin.z);
+        _mm_store_ps(maxX, boxMax.x);
+        _mm_store_ps(maxY, boxMax.y);
+        _mm_store_ps(maxZ, boxMax.z);
+
+        for (uint32_t i = 0; i < 4; i++) {
+            aabb.Add(float3(minX[i], minY[i], minZ[i]));
+            aabb.Add(float3(maxX[i], maxY[i], maxZ[i]));
+        }
+    }
+}
 
-        float3 edge20 = p2 - p0;
-        float3 edge10 = p1 - p0;
-        float worldArea = length(cross(edge20, edge10)) * 0.5f;
+// Morph target positions and normals (deltas) plus accumulated tangent frames to "MorphVertex" stream
+static void PackMorphVertices(const utils::UnpackedVertex* baseVertices, const uint8_t* positionSrc, size_t positionStride, const uint8_t* normalSrc, size_t normalStride, const float3* tangents, const float3* bitangents, size_t vertexNum, utils::MorphVertex* morphVertices) {
+    alignas(16) float px[VERTEX_PACKING_BATCH], py[VERTEX_PACKING_BATCH], pz[VERTEX_PACKING_BATCH];
+    alignas(16) float nx[VERTEX_PACKING_BATCH], ny[VERTEX_PACKING_BATCH], nz[VERTEX_PACKING_BATCH];
+    alignas(16) float tx[VERTEX_PACKING_BATCH], ty[VERTEX_PACKING_BATCH], tz[VERTEX_PACKING_BATCH];
+    alignas(16) float bx[VERTEX_PACKING_BATCH], by[VERTEX_PACKING_BATCH], bz[VERTEX_PACKING_BATCH];
+    alignas(16) uint32_t packedPos[VERTEX_PACKING_BATCH * 2];
+    alignas(16) uint32_t packedN[VERTEX_PACKING_BATCH];
+    alignas(16) uint32_t packedT[VERTEX_PACKING_BATCH];
+
+    for (size_t base = 0; base < vertexNum; base += VERTEX_PACKING_BATCH) {
+        size_t num = min(vertexNum - base, VERTEX_PACKING_BATCH);
+
+        // Gather
+        for (size_t i = 0; i < VERTEX_PACKING_BATCH; i++) {
+            size_t j = base + min(i, num - 1);
+            const utils::UnpackedVertex& v = baseVertices[j];
+
+            const float* p = (const float*)(positionSrc + positionStride * j);
+            px[i] = p[0] + v.pos[0];
+            py[i] = p[1] + v.pos[1];
+            pz[i] = p[2] + v.pos[2];
+
+            const float* n = (const float*)(normalSrc + normalStride * j);
+            nx[i] = n[0] + v.N[0];
+            ny[i] = n[1] + v.N[1];
+            nz[i] = n[2] + v.N[2];
+
+            tx[i] = tangents[j].x;
+            ty[i] = tangents[j].y;
+            tz[i] = tangents[j].z;
+
+            bx[i] = bitangents[j].x;
+            by[i] = bitangents[j].y;
+            bz[i] = bitangents[j].z;
+        }
 
-        float3 uvEdge20 = float3(v2.uv[0], v2.uv[1], 0.0f) - float3(v0.uv[0], v0.uv[1], 0.0f);
-        float3 uvEdge10 = float3(v1.uv[0], v1.uv[1], 0.0f) - float3(v0.uv[0], v0.uv[1], 0.0f);
-        float uvArea = length(cross(uvEdge20, uvEdge10)) * 0.5f;
+        // Pack
+        for (size_t i = 0; i < VERTEX_PACKING_BATCH; i += 4) {
+            SoA3 N = {_mm_load_ps(nx + i), _mm_load_ps(ny + i), _mm_load_ps(nz + i)};
+            SoA3 T = {_mm_load_ps(tx + i), _mm_load_ps(ty + i), _mm_load_ps(tz + i)};
+            SoA3 B = {_mm_load_ps(bx + i), _mm_load_ps(by + i), _mm_load_ps(bz + i)};
 
-        utils::Primitive& primitive = scene.primitives[primitiveBaseIndex / 3];
-        primitive.uvArea = max(uvArea, 1e-9f);
-        primitive.worldArea = max(worldArea, 1e-9f);
+            // Gram-Schmidt orthogonalize, a degenerate tangent is derived from the bitangent
+            __m128 NdotT = Dot(N, T);
+            SoA3 orthogonal = {_mm_sub_ps(T.x, _mm_mul_ps(N.x, NdotT)), _mm_sub_ps(T.y, _mm_mul_ps(N.y, NdotT)), _mm_sub_ps(T.z, _mm_mul_ps(N.z, NdotT))};
+            SoA3 fallback = Cross(B, N);
 
-        // Tangent
-        float3 n1 = float3(v1.N);
-        float r = uvEdge10.x * uvEdge20.y - uvEdge20.x * uvEdge10.y;
+            __m128 isDegenerate = _mm_cmplt_ps(_mm_sqrt_ps(Dot(T, T)), _mm_set1_ps(1e-9f));
+            T.x = Select(orthogonal.x, fallback.x, isDegenerate);
+            T.y = Select(orthogonal.y, fallback.y, isDegenerate);
+            T.z = Select(orthogonal.z, fallback.z, isDegenerate);
+            T = Normalize(T);
 
-        float3 tangent, bitangent;
-        if (abs(r) < 1e-9f) {
-            n1.z += 1e-6f;
+            __m128 handedness = Sign(Dot(Cross(N, T), B));
 
-            tangent = GetPerpendicularVector(n1);
-            bitangent = cross(n1, tangent);
-        } else {
-            float invr = 1.0f / r;
+            __m128 encodedNx, encodedNy, encodedTx, encodedTy;
+            EncodeUnitVector(N, encodedNx, encodedNy);
+            EncodeUnitVector(T, encodedTx, encodedTy);
 
-            float3 a = (p1 - p0) * invr;
-            float3 b = (p2 - p0) * invr;
+            __m128i posXY = _mm_unpacklo_epi16(ToHalf(_mm_load_ps(px + i)), ToHalf(_mm_load_ps(py + i)));
+            __m128i posZW = _mm_unpacklo_epi16(ToHalf(_mm_load_ps(pz + i)), ToHalf(handedness));
+            _mm_store_si128((__m128i*)(packedPos + i * 2), _mm_unpacklo_epi32(posXY, posZW));
+            _mm_store_si128((__m128i*)(packedPos + i * 2 + 4), _mm_unpackhi_epi32(posXY, posZW));
 
-            tangent = a * uvEdge20.y - b * uvEdge10.y;
-            bitangent = b * uvEdge10.x - a * uvEdge20.x;
+            _mm_store_si128((__m128i*)(packedN + i), _mm_unpacklo_epi16(ToHalf(encodedNx), ToHalf(encodedNy)));
+            _mm_store_si128((__m128i*)(packedT + i), _mm_unpacklo_epi16(ToHalf(encodedTx), ToHalf(encodedTy)));
         }
 
-        tangents[i0] += tangent;
-        tangents[i1] += tangent;
-        tangents[i2] += tangent;
-
-        bitangents[i0] += bitangent;
-        bitangents[i1] += bitangent;
-        bitangents[i2] += bitangent;
+        // Scatter
+        for (size_t i = 0; i < num; i++) {
+            utils::MorphVertex& morphVertex = morphVertices[base + i];
+            memcpy(&morphVertex.pos, packedPos + i * 2, sizeof(morphVertex.pos));
+            memcpy(&morphVertex.N, packedN + i, sizeof(morphVertex.N));
+            memcpy(&morphVertex.T, packedT + i, sizeof(morphVertex.T));
+        }
     }
+}
 
-    for (size_t j = 0; j < mesh.vertexNum; j++) {
-        utils::UnpackedVertex& unpackedVertex = scene.unpackedVertices[mesh.vertexOffset + j];
-        float3 N = float3(unpackedVertex.N);
+utils::UnpackedVertex utils::UnpackVertex(const Vertex& vertex) {
+    auto unorm = [](uint32_t packed, uint32_t shift, uint32_t bits) {
+        uint32_t mask = (1u << bits) - 1;
 
-        float3 T = tangents[j];
-        if (length(T) < 1e-9f)
-            T = cross(bitangents[j], N);
-        else // Gram-Schmidt orthogonalize
-            T -= N * dot(N, T);
-        T = normalize(T);
+        return float((packed >> shift) & mask) / float(mask);
+    };
 
-        // Calculate handedness
-        float handedness = sign(dot(cross(N, T), bitangents[j]));
+    UnpackedVertex unpackedVertex = {};
+    unpackedVertex.pos[0] = vertex.pos[0];
+    unpackedVertex.pos[1] = vertex.pos[1];
+    unpackedVertex.pos[2] = vertex.pos[2];
 
-        // Output
-        float4 result = float4(T.x, T.y, T.z, handedness);
-        unpackedVertex.T[0] = result.x;
-        unpackedVertex.T[1] = result.y;
-        unpackedVertex.T[2] = result.z;
-        unpackedVertex.T[3] = result.w;
+    float2 uv = float2(vertex.uv);
+    unpackedVertex.uv[0] = uv.x;
+    unpackedVertex.uv[1] = uv.y;
 
-        utils::Vertex& vertex = scene.vertices[mesh.vertexOffset + j];
-        vertex.T = Packing::float4_to_unorm<10, 10, 10, 2>(result * 0.5f + 0.5f);
+    for (uint32_t i = 0; i < 3; i++) {
+        unpackedVertex.N[i] = unorm(vertex.N, i * 10, 10) * 2.0f - 1.0f;
+        unpackedVertex.T[i] = unorm(vertex.T, i * 10, 10) * 2.0f - 1.0f;
     }
+    unpackedVertex.T[3] = unorm(vertex.T, 30, 2) * 2.0f - 1.0f;
+
+    return unpackedVertex;
 }
 
-inline const char* GetShaderExt(nri::GraphicsAPI graphicsAPI) {
-    if (graphicsAPI == nri::GraphicsAPI::D3D11)
-        return ".dxbc";
-    else if (graphicsAPI == nri::GraphicsAPI::D3D12)
-        return ".dxil";
+// "Scene::unpackedVertices" is empty if "LoadSceneDesc::keepUnpackedVertices" is not set
+static inline bool HasUnpackedVertices(const utils::Scene& scene, const utils::Mesh& mesh) {
+    return mesh.vertexOffset + mesh.vertexNum <= scene.unpackedVertices.size();
+}
 
-    return ".spirv";
+// Unpacked vertices of a mesh, decoded into "scratch" if not available
+static utils::UnpackedVertex* GetUnpackedVertices(utils::Scene& scene, const utils::Mesh& mesh, std::vector<utils::UnpackedVertex>& scratch) {
+    if (HasUnpackedVertices(scene, mesh))
+        return scene.unpackedVertices.data() + mesh.vertexOffset;
+
+    scratch.resize(mesh.vertexNum);
+    for (uint32_t i = 0; i < mesh.vertexNum; i++)
+        scratch[i] = utils::UnpackVertex(scene.vertices[mesh.vertexOffset + i]);
+
+    return scratch.data();
 }
 
-static struct FormatMapping {
-    uint32_t detexFormat;
-    nri::Format nriFormat;
-} formatTable[] = {
-    // Uncompressed formats.
-    {DETEX_PIXEL_FORMAT_RGB8, nri::Format::UNKNOWN},
-    {DETEX_PIXEL_FORMAT_RGBA8, nri::Format::RGBA8_UNORM},
-    {DETEX_PIXEL_FORMAT_R8, nri::Format::R8_UNORM},
-    {DETEX_PIXEL_FORMAT_SIGNED_R8, nri::Format::R8_SNORM},
-    {DETEX_PIXEL_FORMAT_RG8, nri::Format::RG8_UNORM},
-    {DETEX_PIXEL_FORMAT_SIGNED_RG8, nri::Format::RG8_SNORM},
-    {DETEX_PIXEL_FORMAT_R16, nri::Format::R16_UNORM},
-    {DETEX_PIXEL_FORMAT_SIGNED_R16, nri::Format::R16_SNORM},
-    {DETEX_PIXEL_FORMAT_RG16, nri::Format::RG16_UNORM},
-    {DETEX_PIXEL_FORMAT_SIGNED_RG16, nri::Format::RG16_SNORM},
-    {DETEX_PIXEL_FORMAT_RGB16, nri::Format::UNKNOWN},
-    {DETEX_PIXEL_FORMAT_RGBA16, nri::Format::RGBA16_UNORM},
-    {DETEX_PIXEL_FORMAT_FLOAT_R16, nri::Format::R16_SFLOAT},
-    {DETEX_PIXEL_FORMAT_FLOAT_RG16, nri::Format::RG16_SFLOAT},
-    {DETEX_PIXEL_FORMAT_FLOAT_RGB16, nri::Format::UNKNOWN},
-    {DETEX_PIXEL_FORMAT_FLOAT_RGBA16, nri::Format::RGBA16_SFLOAT},
-    {DETEX_PIXEL_FORMAT_FLOAT_R32, nri::Format::R32_SFLOAT},
-    {DETEX_PIXEL_FORMAT_FLOAT_RG32, nri::Format::RG32_SFLOAT},
-    {DETEX_PIXEL_FORMAT_FLOAT_RGB32, nri::Format::RGB32_SFLOAT},
-    {DETEX_PIXEL_FORMAT_FLOAT_RGBA32, nri::Format::RGBA32_SFLOAT},
-    {DETEX_PIXEL_FORMAT_A8, nri::Format::UNKNOWN},
-    // Compressed formats.
-    {DETEX_TEXTURE_FORMAT_BC1, nri::Format::BC1_RGBA_UNORM},
-    {DETEX_TEXTURE_FORMAT_BC1A, nri::Format::UNKNOWN},
-    {DETEX_TEXTURE_FORMAT_BC2, nri::Format::BC2_RGBA_UNORM},
-    {DETEX_TEXTURE_FORMAT_BC3, nri::Format::BC3_RGBA_UNORM},
-    {DETEX_TEXTURE_FORMAT_RGTC1, nri::Format::BC4_R_UNORM},
-    {DETEX_TEXTURE_FORMAT_SIGNED_RGTC1, nri::Format::BC4_R_SNORM},
-    {DETEX_TEXTURE_FORMAT_RGTC2, nri::Format::BC5_RG_UNORM},
-    {DETEX_TEXTURE_FORMAT_SIGNED_RGTC2, nri::Format::BC5_RG_SNORM},
-    {DETEX_TEXTURE_FORMAT_BPTC_FLOAT, nri::Format::BC6H_RGB_UFLOAT},
-    {DETEX_TEXTURE_FORMAT_BPTC_SIGNED_FLOAT, nri::Format::BC6H_RGB_SFLOAT},
-    {DETEX_TEXTURE_FORMAT_BPTC, nri::Format::BC7_RGBA_UNORM},
-    {DETEX_TEXTURE_FORMAT_ETC1, nri::Format::UNKNOWN},
-    {DETEX_TEXTURE_FORMAT_ETC2, nri::Format::UNKNOWN},
-    {DETEX_TEXTURE_FORMAT_ETC2_PUNCHTHROUGH, nri::Format::UNKNOWN},
-    {DETEX_TEXTURE_FORMAT_ETC2_EAC, nri::Format::UNKNOWN},
-    {DETEX_TEXTURE_FORMAT_EAC_R11, nri::Format::UNKNOWN},
-    {DETEX_TEXTURE_FORMAT_EAC_SIGNED_R11, nri::Format::UNKNOWN},
-    {DETEX_TEXTURE_FORMAT_EAC_RG11, nri::Format::UNKNOWN},
-    {DETEX_TEXTURE_FORMAT_EAC_SIGNED_RG11, nri::Format::UNKNOWN},
-};
+// 8, 16 or 32 bit indices to "Index", tightly packed 32 bit indices are copied as is
+static void WidenIndices(const uint8_t* src, size_t stride, size_t componentSize, size_t indexNum, utils::Index* dst) {
+    if (stride == componentSize && componentSize == sizeof(utils::Index)) {
+        memcpy(dst, src, indexNum * sizeof(utils::Index));
+        return;
+    }
 
-static nri::Format GetFormatNRI(uint32_t detexFormat) {
-    for (auto& entry : formatTable) {
-        if (entry.detexFormat == detexFormat)
-            return entry.nriFormat;
+    size_t i = 0;
+    __m128i zero = _mm_setzero_si128();
+
+    if (stride == componentSize && componentSize == sizeof(uint16_t)) {
+        for (; i + 8 <= indexNum; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i * sizeof(uint16_t)));
+
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(v, zero));
+            _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(v, zero));
+        }
+    } else if (stride == componentSize && componentSize == sizeof(uint8_t)) {
+        for (; i + 16 <= indexNum; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128((__m128i*)(dst + i + 12), _mm_unpackhi_epi16(hi, zero));
+        }
     }
 
-    return nri::Format::UNKNOWN;
+    // Strided or remaining
+    if (componentSize == sizeof(uint8_t)) {
+        for (; i < indexNum; i++)
+            dst[i] = (utils::Index)src[i * stride];
+    } else if (componentSize == sizeof(uint16_t)) {
+        for (; i < indexNum; i++) {
+            uint16_t index;
+            memcpy(&index, src + i * stride, sizeof(index));
+            dst[i] = (utils::Index)index;
+        }
+    } else {
+        for (; i < indexNum; i++)
+            memcpy(dst + i, src + i * stride, sizeof(utils::Index));
+    }
 }
 
-static nri::Format MakeSRGBFormat(nri::Format format) {
-    switch (format) {
-        case nri::Format::RGBA8_UNORM:
-            return nri::Format::RGBA8_SRGB;
+// "CompactVertex" stream of the last loaded scene (vertices must be final)
+static void PackCompactVertices(utils::Scene& scene, uint32_t meshOffset) {
+    scene.compactVertices.resize(scene.vertices.size());
 
-        case nri::Format::BC1_RGBA_UNORM:
-            return nri::Format::BC1_RGBA_SRGB;
+    uint32_t meshNum = (uint32_t)scene.meshes.size() - meshOffset;
+    std::vector<std::vector<utils::UnpackedVertex>> scratch(utils::GetThreadNum());
 
-        case nri::Format::BC2_RGBA_UNORM:
-            return nri::Format::BC2_RGBA_SRGB;
+    utils::ParallelFor(meshNum, 1, [&](uint32_t begin, uint32_t end, uint32_t threadIndex) {
+        for (uint32_t i = begin; i < end; i++) {
+            const utils::Mesh& mesh = scene.meshes[meshOffset + i];
+            const utils::UnpackedVertex* unpackedVertices = GetUnpackedVertices(scene, mesh, scratch[threadIndex]);
 
-        case nri::Format::BC3_RGBA_UNORM:
-            return nri::Format::BC3_RGBA_SRGB;
+            float3 bias = mesh.GetPositionBias();
+            float3 scale = mesh.GetPositionScale();
+            float3 invScale = float3(scale.x > 0.0f ? 1.0f / scale.x : 0.0f, scale.y > 0.0f ? 1.0f / scale.y : 0.0f, scale.z > 0.0f ? 1.0f / scale.z : 0.0f);
 
-        case nri::Format::BC7_RGBA_UNORM:
-            return nri::Format::BC7_RGBA_SRGB;
+            for (uint32_t j = 0; j < mesh.vertexNum; j++) {
+                const utils::UnpackedVertex& unpackedVertex = unpackedVertices[j];
+                utils::CompactVertex& compactVertex = scene.compactVertices[mesh.vertexOffset + j];
 
-        default:
-            return format;
-    }
-}
+                float3 pos = (float3(unpackedVertex.pos) - bias) * invScale;
+                compactVertex.pos[0] = (uint16_t)(saturate(pos.x) * 65535.0f + 0.5f);
+                compactVertex.pos[1] = (uint16_t)(saturate(pos.y) * 65535.0f + 0.5f);
+                compactVertex.pos[2] = (uint16_t)(saturate(pos.z) * 65535.0f + 0.5f);
 
-//========================================================================================================================
-// TEXTURE
-//========================================================================================================================
+                float2 n = Packing::EncodeUnitVector(float3(unpackedVertex.N), false);
+                compactVertex.N = (uint32_t)(n.x * 65535.0f + 0.5f) | ((uint32_t)(n.y * 65535.0f + 0.5f) << 16);
 
-inline detexTexture** ToTexture(utils::Mip* mips) {
-    return (detexTexture**)mips;
-}
+                float2 t = Packing::EncodeUnitVector(float3(unpackedVertex.T), false);
+                compactVertex.T = (uint16_t)((uint32_t)(t.x * 255.0f + 0.5f) | ((uint32_t)(t.y * 127.0f + 0.5f) << 8) | (unpackedVertex.T[3] < 0.0f ? 0x8000 : 0));
 
-inline detexTexture* ToMip(utils::Mip mip) {
-    return (detexTexture*)mip;
+                compactVertex.uv = float2(unpackedVertex.uv[0], unpackedVertex.uv[1]);
+            }
+        }
+    });
 }
 
-utils::Texture::~Texture() {
-    detexFreeTexture(ToTexture(mips), mipNum);
-}
+// Position and attribute streams of the last loaded scene (vertices must be final)
+static void PackVertexStreams(utils::Scene& scene, uint32_t meshOffset) {
+    uint32_t meshNum = (uint32_t)scene.meshes.size() - meshOffset;
 
-void utils::Texture::GetSubresource(nri::TextureSubresourceUploadDesc& subresource, uint32_t mipIndex, uint32_t arrayIndex) const {
-    // TODO: 3D images are not supported, "subresource.slices" needs to be allocated to store pointers to all slices of the current mipmap
-    assert(GetDepth() == 1);
-    (void)(arrayIndex); // TODO: unused
+    for (uint32_t i = 0; i < meshNum; i++) {
+        utils::Mesh& mesh = scene.meshes[meshOffset + i];
+        mesh.streamVertexOffset = (uint32_t)scene.vertexPositions.size();
 
-    detexTexture* mip = ToMip(mips[mipIndex]);
+        scene.vertexPositions.resize(scene.vertexPositions.size() + mesh.vertexNum);
+        scene.vertexAttributes.resize(scene.vertexAttributes.size() + mesh.vertexNum);
+    }
 
-    int rowPitch, slicePitch;
-    detexComputePitch(mip->format, mip->width, mip->height, &rowPitch, &slicePitch);
+    utils::ParallelFor(meshNum, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t i = begin; i < end; i++) {
+            const utils::Mesh& mesh = scene.meshes[meshOffset + i];
 
-    subresource.slices = mip->data;
-    subresource.sliceNum = 1;
-    subresource.rowPitch = (uint32_t)rowPitch;
-    subresource.slicePitch = (uint32_t)slicePitch;
-}
+            for (uint32_t j = 0; j < mesh.vertexNum; j++) {
+                const utils::Vertex& vertex = scene.vertices[mesh.vertexOffset + j];
 
-bool utils::Texture::IsBlockCompressed() const {
-    return detexFormatIsCompressed(ToMip(mips[0])->format);
+                utils::VertexPosition& position = scene.vertexPositions[mesh.streamVertexOffset + j];
+                memcpy(position.pos, vertex.pos, sizeof(position.pos));
+
+                utils::VertexAttributes& attributes = scene.vertexAttributes[mesh.streamVertexOffset + j];
+                attributes.uv = vertex.uv;
+                attributes.N = vertex.N;
+                attributes.T = vertex.T;
+            }
+        }
+    });
 }
 
-const char* utils::GetFileName(const std::string& path) {
-    const size_t slashPos = path.find_last_of("\\/");
-    if (slashPos != std::string::npos)
-        return path.c_str() + slashPos + 1;
+// Narrows to 16 bits ("_mm_packus_epi32" is SSE4.1, signed saturation is used with a bias instead)
+static void NarrowIndices(const utils::Index* src, size_t indexNum, uint16_t* dst) {
+    __m128i bias32 = _mm_set1_epi32(0x8000);
+    __m128i bias16 = _mm_set1_epi16(-0x8000);
 
-    return "";
+    size_t i = 0;
+    for (; i + 8 <= indexNum; i += 8) {
+        __m128i lo = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(src + i)), bias32);
+        __m128i hi = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(src + i + 4)), bias32);
+
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi16(_mm_packs_epi32(lo, hi), bias16));
+    }
+
+    for (; i < indexNum; i++)
+        dst[i] = (uint16_t)src[i];
 }
 
-//========================================================================================================================
-// UTILS
-//========================================================================================================================
+// Indices of small meshes (without morph targets) of the last loaded scene move to "indices16"
+static void CompactSceneIndices(utils::Scene& scene, uint32_t meshOffset) {
+    // Skipped glTF primitives leave empty meshes with zero offsets
+    size_t indexNum = scene.indices.size();
+    for (size_t i = meshOffset; i < scene.meshes.size(); i++) {
+        if (scene.meshes[i].indexNum)
+            indexNum = min(indexNum, (size_t)scene.meshes[i].indexOffset);
+    }
 
-std::string utils::GetFullPath(const std::string& localPath, DataFolder dataFolder) {
-    std::string path = "";
-    if (dataFolder == DataFolder::SHADERS)
-        path = "_Shaders/";
-    else if (dataFolder == DataFolder::TEXTURES)
-        path = "_Data/Textures/";
-    else if (dataFolder == DataFolder::SCENES)
-        path = "_Data/Scenes/";
-    else if (dataFolder == DataFolder::TESTS)
-        path = "Tests/";
+    auto compactRange = [&](uint32_t& indexOffset, uint32_t rangeIndexNum, bool is16bit) {
+        const utils::Index* src = scene.indices.data() + indexOffset;
 
-    for (uint32_t i = 0; i < 4; i++) {
-        if (std::filesystem::exists(path))
-            break;
+        if (is16bit) {
+            size_t offset = scene.indices16.size();
+            scene.indices16.resize(offset + rangeIndexNum);
+            NarrowIndices(src, rangeIndexNum, scene.indices16.data() + offset);
 
-        path = "../" + path;
-    }
+            indexOffset = (uint32_t)offset;
+        } else {
+            // Moves down or stays in place
+            memmove(scene.indices.data() + indexNum, src, rangeIndexNum * sizeof(utils::Index));
 
-    return path + localPath;
-}
+            indexOffset = (uint32_t)indexNum;
+            indexNum += rangeIndexNum;
+        }
+    };
 
-bool utils::LoadFile(const std::string& path, std::vector<uint8_t>& data) {
-    FILE* file = fopen(path.c_str(), "rb");
+    // LODs are stored after all meshes
+    for (size_t i = meshOffset; i < scene.meshes.size(); i++) {
+        utils::Mesh& mesh = scene.meshes[i];
+        if (mesh.vertexNum <= 65536 && !mesh.HasMorphTargets())
+            mesh.indexType = nri::IndexType::UINT16;
 
-    if (file == nullptr) {
-        printf("ERROR: File '%s' is not found!\n", path.c_str());
-        data.clear();
-        return false;
+        compactRange(mesh.indexOffset, mesh.indexNum, mesh.indexType == nri::IndexType::UINT16);
     }
 
-    printf("Loading file '%s'...\n", GetFileName(path));
+    for (size_t i = meshOffset; i < scene.meshes.size(); i++) {
+        const utils::Mesh& mesh = scene.meshes[i];
 
-    fseek(file, 0, SEEK_END);
-    const size_t size = ftell(file); // 32-bit size
-    fseek(file, 0, SEEK_SET);
+        for (uint32_t j = 0; j < mesh.lodNum; j++) {
+            utils::MeshLod& lod = scene.meshLods[mesh.lodOffset + j];
+            compactRange(lod.indexOffset, lod.indexNum, mesh.indexType == nri::IndexType::UINT16);
+        }
+    }
+
+    scene.indices.resize(indexNum);
+}
 
-    data.resize(size);
-    const size_t readSize = fread(&data[0], size, 1, file);
-    fclose(file);
+//========================================================================================================================
+// MESH OPTIMIZATION
+//========================================================================================================================
 
-    return !data.empty() && readSize == 1;
+// Sparse morph targets keep the rest pose after the targets while loading
+static inline uint32_t GetMorphBlockNum(const utils::Mesh& mesh) {
+    return mesh.morphTargetNum + (mesh.morphTargetOffset != utils::InvalidIndex ? 1 : 0);
 }
 
-nri::ShaderDesc utils::LoadShader(nri::GraphicsAPI graphicsAPI, const std::string& shaderName, ShaderCodeStorage& storage, const char* entryPointName) {
-    const char* ext = GetShaderExt(graphicsAPI);
-    std::string path = GetFullPath(shaderName + ext, DataFolder::SHADERS);
-    nri::ShaderDesc shaderDesc = {};
+// Vertex and morph target streams of a mesh, reordered consistently
+static void RemapMeshVertices(utils::Scene& scene, const utils::Mesh& mesh, const uint32_t* remap, uint32_t vertexNum) {
+    meshopt_remapVertexBuffer(&scene.vertices[mesh.vertexOffset], &scene.vertices[mesh.vertexOffset], mesh.vertexNum, sizeof(utils::Vertex), remap);
+    if (HasUnpackedVertices(scene, mesh))
+        meshopt_remapVertexBuffer(&scene.unpackedVertices[mesh.vertexOffset], &scene.unpackedVertices[mesh.vertexOffset], mesh.vertexNum, sizeof(utils::UnpackedVertex), remap);
 
-    size_t i = 1;
-    for (; i < gShaderExts.size(); i++) {
-        if (path.rfind(gShaderExts[i].ext) != std::string::npos) {
-            storage.push_back(std::vector<uint8_t>());
-            std::vector<uint8_t>& code = storage.back();
+    // Targets get packed with the new vertex count
+    uint32_t morphBlockNum = GetMorphBlockNum(mesh);
+    for (uint32_t i = 0; i < morphBlockNum; i++) {
+        utils::MorphVertex* src = &scene.morphVertices[mesh.morphTargetVertexOffset + i * mesh.vertexNum];
+        utils::MorphVertex* dst = &scene.morphVertices[mesh.morphTargetVertexOffset + i * vertexNum];
 
-            if (LoadFile(path, code)) {
-                shaderDesc.stage = gShaderExts[i].stage;
-                shaderDesc.bytecode = code.data();
-                shaderDesc.size = code.size();
-                shaderDesc.entryPointName = entryPointName;
-            }
+        meshopt_remapVertexBuffer(src, src, mesh.vertexNum, sizeof(utils::MorphVertex), remap);
+        memmove(dst, src, vertexNum * sizeof(utils::MorphVertex));
+    }
+}
 
-            break;
+// Updates "indexNum" and "vertexNum", data stays at the beginning of the original ranges
+static void OptimizeMesh(utils::Scene& scene, utils::Mesh& mesh, std::vector<uint32_t>& remap, std::vector<utils::UnpackedVertex>& scratch) {
+    uint32_t* indices = &scene.indices[mesh.indexOffset];
+    const utils::UnpackedVertex* unpackedVertices = GetUnpackedVertices(scene, mesh, scratch);
+
+    // Weld (morphed vertices must match in all targets)
+    std::vector<meshopt_Stream> streams;
+    streams.push_back({unpackedVertices, sizeof(utils::UnpackedVertex), sizeof(utils::UnpackedVertex)});
+    uint32_t morphBlockNum = GetMorphBlockNum(mesh);
+    for (uint32_t i = 0; i < morphBlockNum; i++)
+        streams.push_back({&scene.morphVertices[mesh.morphTargetVertexOffset + i * mesh.vertexNum], sizeof(utils::MorphVertex), sizeof(utils::MorphVertex)});
+
+    remap.resize(mesh.vertexNum);
+    uint32_t vertexNum = (uint32_t)meshopt_generateVertexRemapMulti(remap.data(), indices, mesh.indexNum, mesh.vertexNum, streams.data(), streams.size());
+
+    meshopt_remapIndexBuffer(indices, indices, mesh.indexNum, remap.data());
+    RemapMeshVertices(scene, mesh, remap.data(), vertexNum);
+    mesh.vertexNum = vertexNum;
+    unpackedVertices = GetUnpackedVertices(scene, mesh, scratch);
+
+    // Remove degenerate triangles (collapsed positions are not degenerate if morphed)
+    uint32_t indexNum = 0;
+    for (uint32_t i = 0; i < mesh.indexNum; i += 3) {
+        uint32_t i0 = indices[i];
+        uint32_t i1 = indices[i + 1];
+        uint32_t i2 = indices[i + 2];
+
+        bool isDegenerate = i0 == i1 || i1 == i2 || i2 == i0;
+        if (!mesh.HasMorphTargets()) {
+            const float* p0 = unpackedVertices[i0].pos;
+            const float* p1 = unpackedVertices[i1].pos;
+            const float* p2 = unpackedVertices[i2].pos;
+
+            isDegenerate = isDegenerate || !memcmp(p0, p1, sizeof(float) * 3) || !memcmp(p1, p2, sizeof(float) * 3) || !memcmp(p2, p0, sizeof(float) * 3);
+        }
+
+        if (!isDegenerate) {
+            indices[indexNum++] = i0;
+            indices[indexNum++] = i1;
+            indices[indexNum++] = i2;
         }
     }
+    mesh.indexNum = indexNum;
 
-    if (i == gShaderExts.size()) {
-        printf("ERROR: Shader '%s' has invalid shader extension!\n", shaderName.c_str());
+    // Triangle order
+    meshopt_optimizeVertexCache(indices, indices, mesh.indexNum, mesh.vertexNum);
+    meshopt_optimizeOverdraw(indices, indices, mesh.indexNum, unpackedVertices[0].pos, mesh.vertexNum, sizeof(utils::UnpackedVertex), 1.05f);
 
-        NRI_ABORT_ON_FALSE(false);
-    };
+    // Vertex order (unreferenced vertices are removed)
+    vertexNum = (uint32_t)meshopt_optimizeVertexFetchRemap(remap.data(), indices, mesh.indexNum, mesh.vertexNum);
 
-    return shaderDesc;
+    meshopt_remapIndexBuffer(indices, indices, mesh.indexNum, remap.data());
+    RemapMeshVertices(scene, mesh, remap.data(), vertexNum);
+    mesh.vertexNum = vertexNum;
 }
 
-namespace utils {
-static void PostProcessTexture(const std::string& name, Texture& texture, bool computeAvgColorAndAlphaMode, detexTexture** dTexture, int mipNum) {
-    texture.mips = (Mip*)dTexture;
-    texture.name = name;
-    texture.format = GetFormatNRI(dTexture[0]->format);
-    texture.width = (uint16_t)dTexture[0]->width;
-    texture.height = (uint16_t)dTexture[0]->height;
-    texture.mipNum = (uint8_t)mipNum;
+// Meshes of the last loaded scene get optimized, then packed back to back
+static void OptimizeSceneMeshes(utils::Scene& scene, uint32_t meshOffset, const std::vector<uint32_t>& meshIndices) {
+    std::vector<std::vector<uint32_t>> remaps(utils::GetThreadNum());
+    std::vector<std::vector<utils::UnpackedVertex>> scratch(utils::GetThreadNum());
+
+    utils::ParallelFor((uint32_t)meshIndices.size(), 1, [&](uint32_t begin, uint32_t end, uint32_t threadIndex) {
+        for (uint32_t i = begin; i < end; i++)
+            OptimizeMesh(scene, scene.meshes[meshIndices[i]], remaps[threadIndex], scratch[threadIndex]);
+    });
+
+    bool hasUnpackedVertices = scene.unpackedVertices.size() == scene.vertices.size();
+
+    // Skipped glTF primitives leave empty meshes with zero offsets
+    uint32_t indexOffset = (uint32_t)scene.indices.size();
+    uint32_t vertexOffset = (uint32_t)scene.vertices.size();
+    uint32_t morphVertexOffset = (uint32_t)scene.morphVertices.size();
+    uint32_t morphIndexOffset = scene.morphIndexNum;
+
+    for (size_t i = meshOffset; i < scene.meshes.size(); i++) {
+        const utils::Mesh& mesh = scene.meshes[i];
+        if (mesh.vertexNum) {
+            indexOffset = min(indexOffset, mesh.indexOffset);
+            vertexOffset = min(vertexOffset, mesh.vertexOffset);
+        }
 
-    // TODO: detex doesn't support cubemaps and 3D textures
-    texture.layerNum = 1;
-    texture.depth = 1;
+        if (mesh.HasMorphTargets()) {
+            morphVertexOffset = min(morphVertexOffset, mesh.morphTargetVertexOffset);
+            morphIndexOffset = min(morphIndexOffset, mesh.morphMeshIndexOffset);
+        }
+    }
 
-    texture.alphaMode = AlphaMode::OPAQUE;
-    if (computeAvgColorAndAlphaMode) {
-        // Alpha mode
-        if (texture.format == nri::Format::BC1_RGBA_UNORM || texture.format == nri::Format::BC1_RGBA_SRGB) {
-            bool hasTransparency = false;
-            for (int i = mipNum - 1; i >= 0 && !hasTransparency; i--) {
-                const size_t size = detexTextureSize(dTexture[i]->width_in_blocks, dTexture[i]->height_in_blocks, dTexture[i]->format);
-                const uint8_t* bc1 = dTexture[i]->data;
+    for (size_t i = meshOffset; i < scene.meshes.size(); i++) {
+        utils::Mesh& mesh = scene.meshes[i];
+
+        // Ranges only move down
+        memmove(scene.indices.data() + indexOffset, scene.indices.data() + mesh.indexOffset, mesh.indexNum * sizeof(utils::Index));
+        memmove(scene.vertices.data() + vertexOffset, scene.vertices.data() + mesh.vertexOffset, mesh.vertexNum * sizeof(utils::Vertex));
+        if (hasUnpackedVertices)
+            memmove(scene.unpackedVertices.data() + vertexOffset, scene.unpackedVertices.data() + mesh.vertexOffset, mesh.vertexNum * sizeof(utils::UnpackedVertex));
+
+        mesh.indexOffset = indexOffset;
+        mesh.vertexOffset = vertexOffset;
+        mesh.primitiveOffset = indexOffset / 3;
+
+        indexOffset += mesh.indexNum;
+        vertexOffset += mesh.vertexNum;
+
+        if (mesh.HasMorphTargets()) {
+            uint32_t morphVertexNum = mesh.vertexNum * GetMorphBlockNum(mesh);
+            memmove(scene.morphVertices.data() + morphVertexOffset, scene.morphVertices.data() + mesh.morphTargetVertexOffset, morphVertexNum * sizeof(utils::MorphVertex));
+
+            mesh.morphTargetVertexOffset = morphVertexOffset;
+            mesh.morphMeshIndexOffset = morphIndexOffset;
+
+            morphVertexOffset += morphVertexNum;
+            morphIndexOffset += mesh.indexNum;
+        }
+    }
+
+    scene.indices.resize(indexOffset);
+    scene.primitives.resize(indexOffset / 3);
+    scene.vertices.resize(vertexOffset);
+    if (hasUnpackedVertices)
+        scene.unpackedVertices.resize(vertexOffset);
+    scene.morphVertices.resize(morphVertexOffset);
+    scene.morphIndexNum = morphIndexOffset;
+}
+
+struct MeshletScratch {
+    std::vector<meshopt_Meshlet> meshlets;
+    std::vector<uint32_t> vertices;
+    std::vector<uint8_t> primitives;
+};
+
+// Meshlets of the last loaded scene, appended to scene arrays in mesh order
+static void GenerateSceneMeshlets(utils::Scene& scene, uint32_t meshOffset, uint32_t maxVertexNum, uint32_t maxPrimitiveNum) {
+    maxVertexNum = clamp(maxVertexNum, 3u, 255u);
+    maxPrimitiveNum = clamp(maxPrimitiveNum & ~3u, 4u, 512u);
+
+    uint32_t meshNum = (uint32_t)scene.meshes.size() - meshOffset;
+    std::vector<MeshletScratch> meshMeshlets(meshNum);
+    std::vector<std::vector<utils::UnpackedVertex>> scratch(utils::GetThreadNum());
+
+    utils::ParallelFor(meshNum, 1, [&](uint32_t begin, uint32_t end, uint32_t threadIndex) {
+        for (uint32_t i = begin; i < end; i++) {
+            const utils::Mesh& mesh = scene.meshes[meshOffset + i];
+            MeshletScratch& result = meshMeshlets[i];
+
+            if (!mesh.indexNum)
+                continue;
+
+            const uint32_t* indices = &scene.indices[mesh.indexOffset];
+            const float* positions = GetUnpackedVertices(scene, mesh, scratch[threadIndex])->pos;
+
+            size_t meshletMaxNum = meshopt_buildMeshletsBound(mesh.indexNum, maxVertexNum, maxPrimitiveNum);
+            result.meshlets.resize(meshletMaxNum);
+            result.vertices.resize(meshletMaxNum * maxVertexNum);
+            result.primitives.resize(meshletMaxNum * maxPrimitiveNum * 3);
+
+            size_t meshletNum = meshopt_buildMeshlets(result.meshlets.data(), result.vertices.data(), result.primitives.data(), indices, mesh.indexNum, positions, mesh.vertexNum, sizeof(utils::UnpackedVertex), maxVertexNum, maxPrimitiveNum, 0.25f);
+            result.meshlets.resize(meshletNum);
+            if (!meshletNum)
+                continue;
+
+            for (meshopt_Meshlet& meshlet : result.meshlets)
+                meshopt_optimizeMeshlet(&result.vertices[meshlet.vertex_offset], &result.primitives[meshlet.triangle_offset], meshlet.triangle_count, meshlet.vertex_count);
+
+            // Primitives of a meshlet are padded to 4 bytes
+            const meshopt_Meshlet& last = result.meshlets.back();
+            result.vertices.resize(last.vertex_offset + last.vertex_count);
+            result.primitives.resize(last.triangle_offset + ((last.triangle_count * 3 + 3) & ~3));
+        }
+    });
+
+    for (uint32_t i = 0; i < meshNum; i++) {
+        utils::Mesh& mesh = scene.meshes[meshOffset + i];
+        const MeshletScratch& result = meshMeshlets[i];
+
+        uint32_t vertexOffset = (uint32_t)scene.meshletVertices.size();
+        uint32_t primitiveOffset = (uint32_t)scene.meshletPrimitives.size();
+
+        mesh.meshletOffset = (uint32_t)scene.meshlets.size();
+        mesh.meshletNum = (uint32_t)result.meshlets.size();
+
+        const float* positions = GetUnpackedVertices(scene, mesh, scratch[0])->pos;
+        for (const meshopt_Meshlet& src : result.meshlets) {
+            meshopt_Bounds bounds = meshopt_computeMeshletBounds(&result.vertices[src.vertex_offset], &result.primitives[src.triangle_offset], src.triangle_count, positions, mesh.vertexNum, sizeof(utils::UnpackedVertex));
+
+            utils::Meshlet meshlet = {};
+            memcpy(meshlet.sphere, bounds.center, sizeof(bounds.center));
+            meshlet.sphere[3] = bounds.radius;
+            memcpy(meshlet.coneApex, bounds.cone_apex, sizeof(bounds.cone_apex));
+            meshlet.coneCutoff = bounds.cone_cutoff;
+            memcpy(meshlet.coneAxis, bounds.cone_axis, sizeof(bounds.cone_axis));
+            meshlet.vertexOffset = vertexOffset + src.vertex_offset;
+            meshlet.primitiveOffset = primitiveOffset + src.triangle_offset;
+            meshlet.vertexNum = src.vertex_count;
+            meshlet.primitiveNum = src.triangle_count;
+
+            scene.meshlets.push_back(meshlet);
+        }
+
+        scene.meshletVertices.insert(scene.meshletVertices.end(), result.vertices.begin(), result.vertices.end());
+        scene.meshletPrimitives.insert(scene.meshletPrimitives.end(), result.primitives.begin(), result.primitives.end());
+    }
+}
+
+//========================================================================================================================
+// MESH LODS
+//========================================================================================================================
+
+constexpr float MESH_LOD_MAX_ERROR = 0.05f;       // relative to the mesh extents
+constexpr float MESH_LOD_MIN_REDUCTION = 0.95f;   // the chain stops if an LOD can't get smaller than this fraction of the previous one
+constexpr uint32_t MESH_LOD_MIN_INDEX_NUM = 3 * 8;
+
+struct MeshLodScratch {
+    std::vector<uint32_t> indices; // LOD "indexOffset" is relative to this array
+    std::vector<utils::MeshLod> lods;
+    std::vector<uint32_t> src;
+    std::vector<uint32_t> dst;
+    std::vector<utils::UnpackedVertex> unpackedVertices;
+};
+
+// Each LOD is simplified from the previous one to about a half of primitives, errors accumulate
+static void GenerateMeshLods(utils::Scene& scene, const utils::Mesh& mesh, uint32_t lodNum, MeshLodScratch& result) {
+    const float* positions = GetUnpackedVertices(scene, mesh, result.unpackedVertices)->pos;
+    float scale = meshopt_simplifyScale(positions, mesh.vertexNum, sizeof(utils::UnpackedVertex));
+
+    result.src.assign(scene.indices.begin() + mesh.indexOffset, scene.indices.begin() + mesh.indexOffset + mesh.indexNum);
+
+    float error = 0.0f;
+    for (uint32_t i = 0; i < lodNum; i++) {
+        size_t targetIndexNum = result.src.size() / 6 * 3;
+        if (targetIndexNum < MESH_LOD_MIN_INDEX_NUM)
+            break;
+
+        result.dst.resize(result.src.size());
+
+        float lodError = 0.0f;
+        size_t indexNum = meshopt_simplify(result.dst.data(), result.src.data(), result.src.size(), positions, mesh.vertexNum, sizeof(utils::UnpackedVertex), targetIndexNum, MESH_LOD_MAX_ERROR, 0, &lodError);
+        if (!indexNum || indexNum > result.src.size() * MESH_LOD_MIN_REDUCTION)
+            break;
+
+        error += lodError * scale; // "lodError" is relative to the previous LOD
+
+        utils::MeshLod& meshLod = result.lods.emplace_back();
+        meshLod.indexOffset = (uint32_t)result.indices.size();
+        meshLod.indexNum = (uint32_t)indexNum;
+        meshLod.error = error;
+
+        result.dst.resize(indexNum);
+        result.indices.insert(result.indices.end(), result.dst.begin(), result.dst.end());
+        result.src.swap(result.dst);
+    }
+}
+
+// LODs of the last loaded scene, their indices are appended after all meshes
+static void GenerateSceneLods(utils::Scene& scene, const std::vector<uint32_t>& meshIndices, uint32_t lodNum) {
+    std::vector<MeshLodScratch> meshLods(meshIndices.size());
+
+    utils::ParallelFor((uint32_t)meshIndices.size(), 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t i = begin; i < end; i++) {
+            const utils::Mesh& mesh = scene.meshes[meshIndices[i]];
+            if (!mesh.HasMorphTargets())
+                GenerateMeshLods(scene, mesh, lodNum, meshLods[i]);
+        }
+    });
+
+    for (size_t i = 0; i < meshIndices.size(); i++) {
+        utils::Mesh& mesh = scene.meshes[meshIndices[i]];
+        const MeshLodScratch& result = meshLods[i];
+
+        mesh.lodOffset = (uint32_t)scene.meshLods.size();
+        mesh.lodNum = (uint32_t)result.lods.size();
+        meshLods[i].unpackedVertices = {};
+
+        uint32_t indexOffset = (uint32_t)scene.indices.size();
+        for (utils::MeshLod meshLod : result.lods) {
+            meshLod.indexOffset += indexOffset;
+            scene.meshLods.push_back(meshLod);
+        }
+
+        scene.indices.insert(scene.indices.end(), result.indices.begin(), result.indices.end());
+    }
+}
+
+uint32_t utils::SelectMeshLod(const Scene& scene, const Instance& instance, const CameraState& camera, float viewportHeight, float maxPixelError) {
+    const Mesh& mesh = scene.meshes[scene.meshInstances[instance.meshInstanceIndex].meshIndex];
+    if (!mesh.lodNum)
+        return 0;
+
+    // Distance to the bounding sphere
+    cBoxf aabb;
+    TransformAabb(instance.rotation, mesh.aabb, aabb);
+
+    float3 center = float3(instance.position - camera.globalPosition) + aabb.GetCenter();
+    float radius = length(aabb.vMax - aabb.vMin) * 0.5f;
+    float distance = max(length(center) - radius, 1e-4f);
+
+    // Pixels per unit of error at the distance (the projection scale is extracted from "mViewToClip")
+    float4 clip = camera.mViewToClip * float4(0.0f, 1.0f, 1.0f, 1.0f);
+    float projectionScale = abs(clip.w) > 1e-6f ? abs(clip.y / clip.w) : abs(clip.y);
+    float3 instanceScale = instance.rotation.GetScale();
+    float errorScale = max(instanceScale.x, max(instanceScale.y, instanceScale.z)) * projectionScale * viewportHeight * 0.5f / distance;
+
+    for (uint32_t i = mesh.lodNum; i > 0; i--) {
+        if (scene.meshLods[mesh.lodOffset + i - 1].error * errorScale <= maxPixelError)
+            return i;
+    }
+
+    return 0;
+}
+
+//========================================================================================================================
+// CULLING
+//========================================================================================================================
+
+constexpr uint32_t CULLING_CHUNK_SIZE = 1024; // instances, a multiple of 4
+constexpr uint32_t CULLING_PLANE_NUM = 6;
+
+// Broadcasted planes of a view
+struct CullingView {
+    SoA3 normals[CULLING_PLANE_NUM];
+    SoA3 absNormals[CULLING_PLANE_NUM];
+    __m128 distances[CULLING_PLANE_NUM];
+    double3 origin; // world position of the origin of "mWorldToClip" space
+};
+
+static void SetupCullingView(const CameraState& camera, CullingView& view) {
+    const float4x4& m = camera.mWorldToClip;
+    float4 r0 = m.Row(0);
+    float4 r1 = m.Row(1);
+    float4 r2 = m.Row(2);
+    float4 r3 = m.Row(3);
+
+    // Clip space depth is in [0; w]
+    float4 planes[CULLING_PLANE_NUM] = {r3 + r0, r3 - r0, r3 + r1, r3 - r1, r2, r3 - r2};
+
+    for (uint32_t i = 0; i < CULLING_PLANE_NUM; i++) {
+        float4 plane = planes[i];
+
+        // Degenerated planes (for example, the far plane of an infinite projection) never cull
+        if (plane.x * plane.x + plane.y * plane.y + plane.z * plane.z < 1e-20f)
+            plane = float4(0.0f, 0.0f, 0.0f, 1.0f);
+
+        view.normals[i] = {_mm_set1_ps(plane.x), _mm_set1_ps(plane.y), _mm_set1_ps(plane.z)};
+        view.absNormals[i] = {_mm_set1_ps(abs(plane.x)), _mm_set1_ps(abs(plane.y)), _mm_set1_ps(abs(plane.z))};
+        view.distances[i] = _mm_set1_ps(plane.w);
+    }
+
+    // "position" is "0" for relative cameras
+    view.origin = camera.globalPosition - double3(camera.position);
+}
+
+// Visible instances of a chunk are written to the beginning of the chunk range in the output
+static void CullChunk(const utils::Scene& scene, const CullingView* views, uint32_t viewNum, uint32_t first, uint32_t last, std::vector<uint32_t>* visibleInstanceIndices, uint32_t* visibleNums) {
+    __m128 zero = _mm_setzero_ps();
+
+    for (uint32_t i = first; i < last; i += 4) {
+        uint32_t laneNum = min(last - i, 4u);
+
+        // Boxes relative to instance positions
+        alignas(16) float cx[4] = {}, cy[4] = {}, cz[4] = {};
+        alignas(16) float ex[4] = {}, ey[4] = {}, ez[4] = {};
+        uint32_t validMask = 0;
+
+        for (uint32_t lane = 0; lane < laneNum; lane++) {
+            const utils::Instance& instance = scene.instances[i + lane];
+            const utils::Mesh& mesh = scene.meshes[scene.meshInstances[instance.meshInstanceIndex].meshIndex];
+            if (!mesh.vertexNum)
+                continue;
+
+            cBoxf aabb;
+            TransformAabb(instance.rotation, mesh.aabb, aabb);
+
+            float3 center = aabb.GetCenter();
+            float3 extent = (aabb.vMax - aabb.vMin) * 0.5f;
+
+            cx[lane] = center.x;
+            cy[lane] = center.y;
+            cz[lane] = center.z;
+            ex[lane] = extent.x;
+            ey[lane] = extent.y;
+            ez[lane] = extent.z;
+
+            validMask |= 1u << lane;
+        }
+
+        if (!validMask)
+            continue;
+
+        SoA3 extent = {_mm_load_ps(ex), _mm_load_ps(ey), _mm_load_ps(ez)};
+
+        for (uint32_t v = 0; v < viewNum; v++) {
+            const CullingView& view = views[v];
+
+            // Positions relative to the view origin are computed in double precision
+            alignas(16) float px[4] = {}, py[4] = {}, pz[4] = {};
+            for (uint32_t lane = 0; lane < laneNum; lane++) {
+                float3 position = float3(scene.instances[i + lane].position - view.origin);
+
+                px[lane] = position.x + cx[lane];
+                py[lane] = position.y + cy[lane];
+                pz[lane] = position.z + cz[lane];
+            }
+
+            SoA3 center = {_mm_load_ps(px), _mm_load_ps(py), _mm_load_ps(pz)};
+
+            // A box is outside if it is fully behind any plane
+            __m128 isVisible = _mm_cmpeq_ps(zero, zero);
+            for (uint32_t p = 0; p < CULLING_PLANE_NUM; p++) {
+                __m128 distance = _mm_add_ps(_mm_add_ps(Dot(view.normals[p], center), Dot(view.absNormals[p], extent)), view.distances[p]);
+                isVisible = _mm_and_ps(isVisible, _mm_cmpge_ps(distance, zero));
+            }
+
+            uint32_t visibleMask = (uint32_t)_mm_movemask_ps(isVisible) & validMask;
+            if (!visibleMask)
+                continue;
+
+            uint32_t* visibleIndices = visibleInstanceIndices[v].data() + first;
+            uint32_t& visibleNum = visibleNums[v];
+
+            for (uint32_t lane = 0; lane < laneNum; lane++) {
+                if (visibleMask & (1u << lane))
+                    visibleIndices[visibleNum++] = i + lane;
+            }
+        }
+    }
+}
+
+void utils::CullInstances(const Scene& scene, const CameraState* cameras, uint32_t cameraNum, std::vector<uint32_t>* visibleInstanceIndices) {
+    uint32_t instanceNum = (uint32_t)scene.instances.size();
+    uint32_t chunkNum = (instanceNum + CULLING_CHUNK_SIZE - 1) / CULLING_CHUNK_SIZE;
+
+    std::vector<CullingView> views(cameraNum);
+    for (uint32_t i = 0; i < cameraNum; i++) {
+        SetupCullingView(cameras[i], views[i]);
+        visibleInstanceIndices[i].resize(instanceNum);
+    }
+
+    // Chunks are culled in parallel, each chunk writes to its own range
+    std::vector<uint32_t> visibleNums(chunkNum * cameraNum, 0);
+
+    ParallelFor(chunkNum, 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t first = i * CULLING_CHUNK_SIZE;
+            uint32_t last = min(first + CULLING_CHUNK_SIZE, instanceNum);
+
+            CullChunk(scene, views.data(), cameraNum, first, last, visibleInstanceIndices, visibleNums.data() + i * cameraNum);
+        }
+    });
+
+    // Compaction, chunk order is preserved
+    for (uint32_t v = 0; v < cameraNum; v++) {
+        uint32_t* indices = visibleInstanceIndices[v].data();
+        uint32_t visibleNum = 0;
+
+        for (uint32_t i = 0; i < chunkNum; i++) {
+            uint32_t chunkVisibleNum = visibleNums[i * cameraNum + v];
+            uint32_t chunkOffset = i * CULLING_CHUNK_SIZE;
+
+            if (visibleNum != chunkOffset)
+                memmove(indices + visibleNum, indices + chunkOffset, chunkVisibleNum * sizeof(uint32_t));
+
+            visibleNum += chunkVisibleNum;
+        }
+
+        visibleInstanceIndices[v].resize(visibleNum);
+    }
+}
+
+//========================================================================================================================
+// MISC
+//========================================================================================================================
+
+// Size and last write time of a file, used to detect changes without reading it
+static void GetFileStamp(const std::filesystem::path& path, uint64_t& size, int64_t& time) {
+    std::error_code ec;
+    size = (uint64_t)std::filesystem::file_size(path, ec); // "-1" if the file doesn't exist
+
+    std::filesystem::file_time_type fileTime = std::filesystem::last_write_time(path, ec);
+    time = ec ? 0 : (int64_t)fileTime.time_since_epoch().count();
+}
+
+// FNV-1a style multiply over 8-byte words with an xor-shift to mix high bits down (not compatible with FNV-1a), not cryptographic
+static uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 0xCBF29CE484222325ull) {
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+
+        hash ^= word;
+        hash *= 0x100000001B3ull;
+        hash ^= hash >> 32;
+    }
+
+    for (; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+// Morph target attribute as tightly packed "float3" deltas (sparse accessors included), zeros if not present
+static const uint8_t* UnpackMorphTargetAttribute(const cgltf_accessor* accessor, size_t vertexNum, std::vector<float>& scratch) {
+    scratch.assign(vertexNum * 3, 0.0f);
+    if (accessor)
+        cgltf_accessor_unpack_floats(accessor, scratch.data(), scratch.size());
+
+    return (const uint8_t*)scratch.data();
+}
+
+// Target independent data of a primitive of a morphed mesh
+struct MorphPrimitive {
+    uint32_t i0, i1, i2;
+    float2 uvEdge10;
+    float2 uvEdge20;
+    float invr; // "0" if UVs are degenerate
+};
+
+// Target independent data of a morphed mesh, shared by all targets
+struct MorphMesh {
+    std::vector<MorphPrimitive> primitives;
+    std::vector<utils::UnpackedVertex> unpackedScratch;
+    const utils::UnpackedVertex* unpackedVertices = nullptr;
+    const cgltf_primitive* gltfPrimitive = nullptr;
+    uint32_t meshIndex = 0;
+};
+
+// Reused across targets, one per thread
+struct MorphScratch {
+    std::vector<float3> tangents;
+    std::vector<float3> bitangents;
+    std::vector<float> positions;
+    std::vector<float> normals;
+};
+
+static void SetupMorphMesh(utils::Scene& scene, MorphMesh& morphMesh) {
+    const utils::Mesh& mesh = scene.meshes[morphMesh.meshIndex];
+    morphMesh.unpackedVertices = GetUnpackedVertices(scene, mesh, morphMesh.unpackedScratch);
+
+    morphMesh.primitives.resize(mesh.indexNum / 3);
+    for (size_t j = 0; j < morphMesh.primitives.size(); j++) {
+        size_t primitiveBaseIndex = mesh.indexOffset + j * 3;
+
+        MorphPrimitive& primitive = morphMesh.primitives[j];
+        primitive.i0 = scene.indices[primitiveBaseIndex];
+        primitive.i1 = scene.indices[primitiveBaseIndex + 1];
+        primitive.i2 = scene.indices[primitiveBaseIndex + 2];
+
+        const utils::UnpackedVertex& v0 = morphMesh.unpackedVertices[primitive.i0];
+        const utils::UnpackedVertex& v1 = morphMesh.unpackedVertices[primitive.i1];
+        const utils::UnpackedVertex& v2 = morphMesh.unpackedVertices[primitive.i2];
+
+        primitive.uvEdge20 = float2(v2.uv[0] - v0.uv[0], v2.uv[1] - v0.uv[1]);
+        primitive.uvEdge10 = float2(v1.uv[0] - v0.uv[0], v1.uv[1] - v0.uv[1]);
+
+        float r = primitive.uvEdge10.x * primitive.uvEdge20.y - primitive.uvEdge20.x * primitive.uvEdge10.y;
+        primitive.invr = abs(r) < 1e-9f ? 0.0f : 1.0f / r;
+    }
+}
+
+// "blockIndex" is a target index or "morphTargetNum" for the rest pose of sparse targets (zero deltas)
+static void GenerateMorphTargetVertices(utils::Scene& scene, const MorphMesh& morphMesh, uint32_t blockIndex, MorphScratch& scratch) {
+    const utils::Mesh& mesh = scene.meshes[morphMesh.meshIndex];
+    const utils::UnpackedVertex* unpackedVertices = morphMesh.unpackedVertices;
+
+    // Src morph target data is delta, missing attributes are zeros
+    const cgltf_accessor* targetPositions = nullptr;
+    const cgltf_accessor* targetNormals = nullptr;
+
+    if (blockIndex < mesh.morphTargetNum) {
+        const cgltf_morph_target& target = morphMesh.gltfPrimitive->targets[blockIndex];
+
+        for (size_t attr_idx = 0; attr_idx < target.attributes_count; attr_idx++) {
+            const cgltf_attribute& attr = target.attributes[attr_idx];
+
+            if (attr.type == cgltf_attribute_type_position)
+                targetPositions = attr.data;
+            else if (attr.type == cgltf_attribute_type_normal)
+                targetNormals = attr.data;
+        }
+    }
+
+    const float* positions = (const float*)UnpackMorphTargetAttribute(targetPositions, mesh.vertexNum, scratch.positions);
+    const float* normals = (const float*)UnpackMorphTargetAttribute(targetNormals, mesh.vertexNum, scratch.normals);
+
+    scratch.tangents.assign(mesh.vertexNum, float3::Zero());
+    scratch.bitangents.assign(mesh.vertexNum, float3::Zero());
+
+    for (const MorphPrimitive& primitive : morphMesh.primitives) {
+        uint32_t i0 = primitive.i0;
+        uint32_t i1 = primitive.i1;
+        uint32_t i2 = primitive.i2;
+
+        float3 tangent, bitangent;
+        if (primitive.invr == 0.0f) {
+            float3 n1 = float3(normals + i1 * 3) + float3(unpackedVertices[i1].N);
+            n1.z += 1e-6f;
+
+            tangent = GetPerpendicularVector(n1);
+            bitangent = cross(n1, tangent);
+        } else {
+            float3 p0 = float3(positions + i0 * 3) + float3(unpackedVertices[i0].pos);
+            float3 p1 = float3(positions + i1 * 3) + float3(unpackedVertices[i1].pos);
+            float3 p2 = float3(positions + i2 * 3) + float3(unpackedVertices[i2].pos);
+
+            float3 a = (p1 - p0) * primitive.invr;
+            float3 b = (p2 - p0) * primitive.invr;
+
+            tangent = a * primitive.uvEdge20.y - b * primitive.uvEdge10.y;
+            bitangent = b * primitive.uvEdge10.x - a * primitive.uvEdge20.x;
+        }
+
+        scratch.tangents[i0] += tangent;
+        scratch.tangents[i1] += tangent;
+        scratch.tangents[i2] += tangent;
+
+        scratch.bitangents[i0] += bitangent;
+        scratch.bitangents[i1] += bitangent;
+        scratch.bitangents[i2] += bitangent;
+    }
+
+    uint32_t vertexOffset = mesh.morphTargetVertexOffset + blockIndex * mesh.vertexNum;
+    PackMorphVertices(unpackedVertices, (const uint8_t*)positions, sizeof(float) * 3, (const uint8_t*)normals, sizeof(float) * 3, scratch.tangents.data(), scratch.bitangents.data(), mesh.vertexNum, &scene.morphVertices[vertexOffset]);
+}
+
+// Morph targets of all meshes of the last loaded scene are generated in parallel
+static void GenerateSceneMorphTargets(utils::Scene& scene, std::vector<MorphMesh>& morphMeshes) {
+    utils::ParallelFor((uint32_t)morphMeshes.size(), 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t i = begin; i < end; i++)
+            SetupMorphMesh(scene, morphMeshes[i]);
+    });
+
+    std::vector<std::pair<uint32_t, uint32_t>> blocks; // morph mesh, block
+    for (uint32_t i = 0; i < (uint32_t)morphMeshes.size(); i++) {
+        uint32_t morphBlockNum = GetMorphBlockNum(scene.meshes[morphMeshes[i].meshIndex]);
+        for (uint32_t j = 0; j < morphBlockNum; j++)
+            blocks.push_back({i, j});
+    }
+
+    std::vector<MorphScratch> scratch(utils::GetThreadNum());
+    utils::ParallelFor((uint32_t)blocks.size(), 1, [&](uint32_t begin, uint32_t end, uint32_t threadIndex) {
+        for (uint32_t i = begin; i < end; i++)
+            GenerateMorphTargetVertices(scene, morphMeshes[blocks[i].first], blocks[i].second, scratch[threadIndex]);
+    });
+}
+
+// Sparse morph targets of the last loaded scene: vertices differing from the rest pose go to "morphDeltas", only rest poses stay in "morphVertices"
+static void SparsifyMorphTargets(utils::Scene& scene, uint32_t meshOffset) {
+    std::vector<uint32_t> meshIndices;
+    for (uint32_t i = meshOffset; i < (uint32_t)scene.meshes.size(); i++) {
+        if (scene.meshes[i].morphTargetOffset != utils::InvalidIndex)
+            meshIndices.push_back(i);
+    }
+
+    if (meshIndices.empty())
+        return;
+
+    // Ranges only move down
+    std::sort(meshIndices.begin(), meshIndices.end(), [&](uint32_t a, uint32_t b) {
+        return scene.meshes[a].morphTargetVertexOffset < scene.meshes[b].morphTargetVertexOffset;
+    });
+
+    uint32_t morphVertexOffset = scene.meshes[meshIndices[0]].morphTargetVertexOffset;
+
+    for (uint32_t meshIndex : meshIndices) {
+        utils::Mesh& mesh = scene.meshes[meshIndex];
+        const utils::MorphVertex* rest = &scene.morphVertices[mesh.morphTargetVertexOffset + mesh.morphTargetNum * mesh.vertexNum];
+
+        for (uint32_t i = 0; i < mesh.morphTargetNum; i++) {
+            const utils::MorphVertex* target = &scene.morphVertices[mesh.morphTargetVertexOffset + i * mesh.vertexNum];
+
+            // Quantization range
+            float maxDelta = 0.0f;
+            for (uint32_t j = 0; j < mesh.vertexNum; j++) {
+                if (!memcmp(&target[j], &rest[j], sizeof(utils::MorphVertex)))
+                    continue;
+
+                float3 delta = float4(target[j].pos).xyz - float4(rest[j].pos).xyz;
+                maxDelta = max(maxDelta, max(abs(delta.x), max(abs(delta.y), abs(delta.z))));
+            }
+
+            utils::MorphTarget& morphTarget = scene.morphTargets[mesh.morphTargetOffset + i];
+            morphTarget.deltaOffset = (uint32_t)scene.morphDeltas.size();
+            morphTarget.positionScale = maxDelta / 32767.0f;
+
+            float invScale = maxDelta > 0.0f ? 32767.0f / maxDelta : 0.0f;
+            for (uint32_t j = 0; j < mesh.vertexNum; j++) {
+                if (!memcmp(&target[j], &rest[j], sizeof(utils::MorphVertex)))
+                    continue;
+
+                float4 pos = float4(target[j].pos);
+                float3 delta = (pos.xyz - float4(rest[j].pos).xyz) * invScale;
+
+                utils::MorphDelta& morphDelta = scene.morphDeltas.emplace_back();
+                morphDelta.vertexIndex = j;
+                morphDelta.pos[0] = (int16_t)clamp(std::round(delta.x), -32767.0f, 32767.0f);
+                morphDelta.pos[1] = (int16_t)clamp(std::round(delta.y), -32767.0f, 32767.0f);
+                morphDelta.pos[2] = (int16_t)clamp(std::round(delta.z), -32767.0f, 32767.0f);
+                morphDelta.pos[3] = pos.w < 0.0f ? -1 : 1;
+                morphDelta.N = target[j].N;
+                morphDelta.T = target[j].T;
+            }
+
+            morphTarget.deltaNum = (uint32_t)scene.morphDeltas.size() - morphTarget.deltaOffset;
+        }
+
+        memmove(scene.morphVertices.data() + morphVertexOffset, rest, mesh.vertexNum * sizeof(utils::MorphVertex));
+
+        mesh.morphTargetVertexOffset = morphVertexOffset;
+        morphVertexOffset += mesh.vertexNum;
+    }
+
+    scene.morphVertices.resize(morphVertexOffset);
+}
+
+void utils::ExpandMorphTarget(const Scene& scene, const Mesh& mesh, uint32_t morphTargetIndex, MorphVertex* morphVertices) {
+    if (mesh.morphTargetOffset == InvalidIndex) {
+        memcpy(morphVertices, &scene.morphVertices[mesh.morphTargetVertexOffset + morphTargetIndex * mesh.vertexNum], mesh.vertexNum * sizeof(MorphVertex));
+        return;
+    }
+
+    memcpy(morphVertices, &scene.morphVertices[mesh.morphTargetVertexOffset], mesh.vertexNum * sizeof(MorphVertex));
+
+    const MorphTarget& morphTarget = scene.morphTargets[mesh.morphTargetOffset + morphTargetIndex];
+    for (uint32_t i = 0; i < morphTarget.deltaNum; i++) {
+        const MorphDelta& morphDelta = scene.morphDeltas[morphTarget.deltaOffset + i];
+        MorphVertex& morphVertex = morphVertices[morphDelta.vertexIndex];
+
+        float4 pos = float4(morphVertex.pos);
+        pos.x += morphDelta.pos[0] * morphTarget.positionScale;
+        pos.y += morphDelta.pos[1] * morphTarget.positionScale;
+        pos.z += morphDelta.pos[2] * morphTarget.positionScale;
+        pos.w = morphDelta.pos[3];
+
+        morphVertex.pos = float16_t4(pos);
+        morphVertex.N = morphDelta.N;
+        morphVertex.T = morphDelta.T;
+    }
+}
+
+// Meshes with more primitives are processed in parallel, smaller meshes are processed in parallel with each other
+constexpr uint32_t PARALLEL_TANGENTS_MIN_PRIMITIVE_NUM = 65536;
+
+// Reused across meshes, one per thread
+struct TangentScratch {
+    std::vector<float3> tangents;
+    std::vector<float3> bitangents;
+    std::vector<uint32_t> vertexPrimitiveOffsets;
+    std::vector<uint32_t> vertexPrimitives;
+    std::vector<utils::UnpackedVertex> unpackedVertices;
+};
+
+static void GetPrimitiveTangent(const utils::Scene& scene, const utils::Mesh& mesh, const utils::UnpackedVertex* unpackedVertices, size_t primitiveIndex, float3& tangent, float3& bitangent, utils::Primitive* primitive) {
+    size_t primitiveBaseIndex = mesh.indexOffset + primitiveIndex * 3;
+
+    size_t i0 = scene.indices[primitiveBaseIndex];
+    size_t i1 = scene.indices[primitiveBaseIndex + 1];
+    size_t i2 = scene.indices[primitiveBaseIndex + 2];
+
+    const utils::UnpackedVertex& v0 = unpackedVertices[i0];
+    const utils::UnpackedVertex& v1 = unpackedVertices[i1];
+    const utils::UnpackedVertex& v2 = unpackedVertices[i2];
+
+    float3 p0(v0.pos);
+    float3 p1(v1.pos);
+    float3 p2(v2.pos);
+
+    float3 uvEdge20 = float3(v2.uv[0], v2.uv[1], 0.0f) - float3(v0.uv[0], v0.uv[1], 0.0f);
+    float3 uvEdge10 = float3(v1.uv[0], v1.uv[1], 0.0f) - float3(v0.uv[0], v0.uv[1], 0.0f);
+
+    if (primitive) {
+        float3 edge20 = p2 - p0;
+        float3 edge10 = p1 - p0;
+        float worldArea = length(cross(edge20, edge10)) * 0.5f;
+        float uvArea = length(cross(uvEdge20, uvEdge10)) * 0.5f;
+
+        primitive->uvArea = max(uvArea, 1e-9f);
+        primitive->worldArea = max(worldArea, 1e-9f);
+    }
+
+    // Tangent
+    float3 n1 = float3(v1.N);
+    float r = uvEdge10.x * uvEdge20.y - uvEdge20.x * uvEdge10.y;
+
+    if (abs(r) < 1e-9f) {
+        n1.z += 1e-6f;
+
+        tangent = GetPerpendicularVector(n1);
+        bitangent = cross(n1, tangent);
+    } else {
+        float invr = 1.0f / r;
+
+        float3 a = (p1 - p0) * invr;
+        float3 b = (p2 - p0) * invr;
+
+        tangent = a * uvEdge20.y - b * uvEdge10.y;
+        bitangent = b * uvEdge10.x - a * uvEdge20.x;
+    }
+}
+
+static void SetVertexTangent(utils::Scene& scene, const utils::Mesh& mesh, utils::UnpackedVertex* unpackedVertices, size_t vertexIndex, float3 T, const float3& bitangent) {
+    utils::UnpackedVertex& unpackedVertex = unpackedVertices[vertexIndex];
+    float3 N = float3(unpackedVertex.N);
+
+    if (length(T) < 1e-9f)
+        T = cross(bitangent, N);
+    else // Gram-Schmidt orthogonalize
+        T -= N * dot(N, T);
+    T = normalize(T);
+
+    // Calculate handedness
+    float handedness = sign(dot(cross(N, T), bitangent));
+
+    // Output
+    float4 result = float4(T.x, T.y, T.z, handedness);
+    unpackedVertex.T[0] = result.x;
+    unpackedVertex.T[1] = result.y;
+    unpackedVertex.T[2] = result.z;
+    unpackedVertex.T[3] = result.w;
+
+    utils::Vertex& vertex = scene.vertices[mesh.vertexOffset + vertexIndex];
+    vertex.T = Packing::float4_to_unorm<10, 10, 10, 2>(result * 0.5f + 0.5f);
+}
+
+static void GeneratePrimitiveDataAndTangents(utils::Scene& scene, const utils::Mesh& mesh, TangentScratch& scratch) {
+    std::vector<float3>& tangents = scratch.tangents;
+    std::vector<float3>& bitangents = scratch.bitangents;
+
+    tangents.assign(mesh.vertexNum, float3::Zero());
+    bitangents.assign(mesh.vertexNum, float3::Zero());
+
+    utils::UnpackedVertex* unpackedVertices = GetUnpackedVertices(scene, mesh, scratch.unpackedVertices);
+
+    size_t primitiveNum = mesh.indexNum / 3;
+    for (size_t j = 0; j < primitiveNum; j++) {
+        size_t primitiveBaseIndex = mesh.indexOffset + j * 3;
+
+        size_t i0 = scene.indices[primitiveBaseIndex];
+        size_t i1 = scene.indices[primitiveBaseIndex + 1];
+        size_t i2 = scene.indices[primitiveBaseIndex + 2];
+
+        float3 tangent, bitangent;
+        GetPrimitiveTangent(scene, mesh, unpackedVertices, j, tangent, bitangent, &scene.primitives[mesh.primitiveOffset + j]);
+
+        tangents[i0] += tangent;
+        tangents[i1] += tangent;
+        tangents[i2] += tangent;
+
+        bitangents[i0] += bitangent;
+        bitangents[i1] += bitangent;
+        bitangents[i2] += bitangent;
+    }
+
+    for (size_t j = 0; j < mesh.vertexNum; j++)
+        SetVertexTangent(scene, mesh, unpackedVertices, j, tangents[j], bitangents[j]);
+}
+
+// Every vertex gathers tangents of adjacent primitives in primitive order, i.e. sums are bit-identical to the serial path
+static void GeneratePrimitiveDataAndTangentsParallel(utils::Scene& scene, const utils::Mesh& mesh, TangentScratch& scratch) {
+    std::vector<uint32_t>& offsets = scratch.vertexPrimitiveOffsets;
+    std::vector<uint32_t>& vertexPrimitives = scratch.vertexPrimitives;
+
+    uint32_t primitiveNum = mesh.indexNum / 3;
+    const utils::Index* indices = scene.indices.data() + mesh.indexOffset;
+    utils::UnpackedVertex* unpackedVertices = GetUnpackedVertices(scene, mesh, scratch.unpackedVertices);
+
+    // Vertex to primitive adjacency (a primitive is listed twice if it references a vertex twice)
+    offsets.assign(mesh.vertexNum + 1, 0);
+    for (uint32_t j = 0; j < primitiveNum * 3; j++)
+        offsets[indices[j] + 1]++;
+
+    for (uint32_t j = 0; j < mesh.vertexNum; j++)
+        offsets[j + 1] += offsets[j];
+
+    vertexPrimitives.resize(primitiveNum * 3);
+    for (uint32_t j = 0; j < primitiveNum * 3; j++)
+        vertexPrimitives[offsets[indices[j]]++] = j / 3;
+
+    for (uint32_t j = mesh.vertexNum; j > 0; j--)
+        offsets[j] = offsets[j - 1];
+    offsets[0] = 0;
+
+    // Per primitive data
+    utils::ParallelFor(primitiveNum, 4096, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t j = begin; j < end; j++) {
+            float3 tangent, bitangent;
+            GetPrimitiveTangent(scene, mesh, unpackedVertices, j, tangent, bitangent, &scene.primitives[mesh.primitiveOffset + j]);
+        }
+    });
+
+    // Tangents (recomputing primitive tangents is cheaper than storing them)
+    utils::ParallelFor(mesh.vertexNum, 4096, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t j = begin; j < end; j++) {
+            float3 T = float3::Zero();
+            float3 B = float3::Zero();
+
+            for (uint32_t k = offsets[j]; k < offsets[j + 1]; k++) {
+                float3 tangent, bitangent;
+                GetPrimitiveTangent(scene, mesh, unpackedVertices, vertexPrimitives[k], tangent, bitangent, nullptr);
+
+                T += tangent;
+                B += bitangent;
+            }
+
+            SetVertexTangent(scene, mesh, unpackedVertices, j, T, B);
+        }
+    });
+}
+
+inline const char* GetShaderExt(nri::GraphicsAPI graphicsAPI) {
+    if (graphicsAPI == nri::GraphicsAPI::D3D11)
+        return ".dxbc";
+    else if (graphicsAPI == nri::GraphicsAPI::D3D12)
+        return ".dxil";
+
+    return ".spirv";
+}
+
+static struct FormatMapping {
+    uint32_t detexFormat;
+    nri::Format nriFormat;
+} formatTable[] = {
+    // Uncompressed formats.
+    {DETEX_PIXEL_FORMAT_RGB8, nri::Format::UNKNOWN},
+    {DETEX_PIXEL_FORMAT_RGBA8, nri::Format::RGBA8_UNORM},
+    {DETEX_PIXEL_FORMAT_R8, nri::Format::R8_UNORM},
+    {DETEX_PIXEL_FORMAT_SIGNED_R8, nri::Format::R8_SNORM},
+    {DETEX_PIXEL_FORMAT_RG8, nri::Format::RG8_UNORM},
+    {DETEX_PIXEL_FORMAT_SIGNED_RG8, nri::Format::RG8_SNORM},
+    {DETEX_PIXEL_FORMAT_R16, nri::Format::R16_UNORM},
+    {DETEX_PIXEL_FORMAT_SIGNED_R16, nri::Format::R16_SNORM},
+    {DETEX_PIXEL_FORMAT_RG16, nri::Format::RG16_UNORM},
+    {DETEX_PIXEL_FORMAT_SIGNED_RG16, nri::Format::RG16_SNORM},
+    {DETEX_PIXEL_FORMAT_RGB16, nri::Format::UNKNOWN},
+    {DETEX_PIXEL_FORMAT_RGBA16, nri::Format::RGBA16_UNORM},
+    {DETEX_PIXEL_FORMAT_FLOAT_R16, nri::Format::R16_SFLOAT},
+    {DETEX_PIXEL_FORMAT_FLOAT_RG16, nri::Format::RG16_SFLOAT},
+    {DETEX_PIXEL_FORMAT_FLOAT_RGB16, nri::Format::UNKNOWN},
+    {DETEX_PIXEL_FORMAT_FLOAT_RGBA16, nri::Format::RGBA16_SFLOAT},
+    {DETEX_PIXEL_FORMAT_FLOAT_R32, nri::Format::R32_SFLOAT},
+    {DETEX_PIXEL_FORMAT_FLOAT_RG32, nri::Format::RG32_SFLOAT},
+    {DETEX_PIXEL_FORMAT_FLOAT_RGB32, nri::Format::RGB32_SFLOAT},
+    {DETEX_PIXEL_FORMAT_FLOAT_RGBA32, nri::Format::RGBA32_SFLOAT},
+    {DETEX_PIXEL_FORMAT_A8, nri::Format::UNKNOWN},
+    // Compressed formats.
+    {DETEX_TEXTURE_FORMAT_BC1, nri::Format::BC1_RGBA_UNORM},
+    {DETEX_TEXTURE_FORMAT_BC1A, nri::Format::UNKNOWN},
+    {DETEX_TEXTURE_FORMAT_BC2, nri::Format::BC2_RGBA_UNORM},
+    {DETEX_TEXTURE_FORMAT_BC3, nri::Format::BC3_RGBA_UNORM},
+    {DETEX_TEXTURE_FORMAT_RGTC1, nri::Format::BC4_R_UNORM},
+    {DETEX_TEXTURE_FORMAT_SIGNED_RGTC1, nri::Format::BC4_R_SNORM},
+    {DETEX_TEXTURE_FORMAT_RGTC2, nri::Format::BC5_RG_UNORM},
+    {DETEX_TEXTURE_FORMAT_SIGNED_RGTC2, nri::Format::BC5_RG_SNORM},
+    {DETEX_TEXTURE_FORMAT_BPTC_FLOAT, nri::Format::BC6H_RGB_UFLOAT},
+    {DETEX_TEXTURE_FORMAT_BPTC_SIGNED_FLOAT, nri::Format::BC6H_RGB_SFLOAT},
+    {DETEX_TEXTURE_FORMAT_BPTC, nri::Format::BC7_RGBA_UNORM},
+    {DETEX_TEXTURE_FORMAT_ETC1, nri::Format::UNKNOWN},
+    {DETEX_TEXTURE_FORMAT_ETC2, nri::Format::UNKNOWN},
+    {DETEX_TEXTURE_FORMAT_ETC2_PUNCHTHROUGH, nri::Format::UNKNOWN},
+    {DETEX_TEXTURE_FORMAT_ETC2_EAC, nri::Format::UNKNOWN},
+    {DETEX_TEXTURE_FORMAT_EAC_R11, nri::Format::UNKNOWN},
+    {DETEX_TEXTURE_FORMAT_EAC_SIGNED_R11, nri::Format::UNKNOWN},
+    {DETEX_TEXTURE_FORMAT_EAC_RG11, nri::Format::UNKNOWN},
+    {DETEX_TEXTURE_FORMAT_EAC_SIGNED_RG11, nri::Format::UNKNOWN},
+};
+
+static nri::Format GetFormatNRI(uint32_t detexFormat) {
+    for (auto& entry : formatTable) {
+        if (entry.detexFormat == detexFormat)
+            return entry.nriFormat;
+    }
+
+    return nri::Format::UNKNOWN;
+}
+
+static nri::Format MakeSRGBFormat(nri::Format format) {
+    switch (format) {
+        case nri::Format::RGBA8_UNORM:
+            return nri::Format::RGBA8_SRGB;
+
+        case nri::Format::BC1_RGBA_UNORM:
+            return nri::Format::BC1_RGBA_SRGB;
+
+        case nri::Format::BC2_RGBA_UNORM:
+            return nri::Format::BC2_RGBA_SRGB;
+
+        case nri::Format::BC3_RGBA_UNORM:
+            return nri::Format::BC3_RGBA_SRGB;
+
+        case nri::Format::BC7_RGBA_UNORM:
+            return nri::Format::BC7_RGBA_SRGB;
+
+        default:
+            return format;
+    }
+}
+
+//========================================================================================================================
+// TEXTURE
+//========================================================================================================================
+
+inline detexTexture** ToTexture(utils::Mip* mips) {
+    return (detexTexture**)mips;
+}
+
+inline detexTexture* ToMip(utils::Mip mip) {
+    return (detexTexture*)mip;
+}
+
+utils::Texture::~Texture() {
+    if (file.IsOpen()) {
+        // Mip data is owned by the file
+        detexTexture** dTexture = ToTexture(mips);
+        for (uint32_t i = 0; i < mipNum; i++)
+            free(dTexture[i]);
+        free(dTexture);
+    } else
+        detexFreeTexture(ToTexture(mips), mipNum);
+}
+
+bool utils::Texture::GetSubresource(nri::TextureSubresourceUploadDesc& subresource, uint32_t mipIndex, uint32_t arrayIndex) const {
+    // TODO: 3D images are not supported, "subresource.slices" needs to be allocated to store pointers to all slices of the current mipmap
+    assert(GetDepth() == 1);
+    (void)(arrayIndex); // TODO: unused
+
+    if (!IsMipResident(mipIndex)) {
+        subresource = {};
+        return false;
+    }
+
+    detexTexture* mip = ToMip(mips[mipIndex]);
+
+    int rowPitch, slicePitch;
+    detexComputePitch(mip->format, mip->width, mip->height, &rowPitch, &slicePitch);
+
+    subresource.slices = mip->data;
+    subresource.sliceNum = 1;
+    subresource.rowPitch = (uint32_t)rowPitch;
+    subresource.slicePitch = (uint32_t)slicePitch;
+
+    return true;
+}
+
+size_t utils::Texture::GetMipSize(uint32_t mipIndex) const {
+    detexTexture* mip = ToMip(mips[mipIndex]);
+
+    int rowPitch, slicePitch;
+    detexComputePitch(mip->format, mip->width, mip->height, &rowPitch, &slicePitch);
+
+    return (size_t)slicePitch;
+}
+
+bool utils::Texture::IsBlockCompressed() const {
+    return detexFormatIsCompressed(ToMip(mips[0])->format);
+}
+
+const char* utils::GetFileName(const std::string& path) {
+    const size_t slashPos = path.find_last_of("\\/");
+    if (slashPos != std::string::npos)
+        return path.c_str() + slashPos + 1;
+
+    return "";
+}
+
+//========================================================================================================================
+// UTILS
+//========================================================================================================================
+
+// Shader bundle: all shaders of an API in one file, entries are sorted by key (name and stage), identical bytecode is stored
+// once. Entries remember size and time of the source file, in debug builds a loose file which doesn't match (i.e. recompiled)
+// is preferred
+constexpr uint32_t SHADER_BUNDLE_MAGIC = 0x4C444E42; // "BNDL"
+constexpr uint32_t SHADER_BUNDLE_VERSION = 2;
+constexpr size_t SHADER_BUNDLE_ALIGNMENT = 16;
+
+struct ShaderBundleHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryNum;
+    uint32_t blobNum;
+};
+
+struct ShaderBundleEntry {
+    uint64_t key;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint32_t blobIndex;
+    uint32_t stage; // nri::StageBits
+};
+
+struct ShaderBundleBlob {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct ShaderBundle {
+    utils::FileView file;
+    const ShaderBundleEntry* entries = nullptr;
+    const ShaderBundleBlob* blobs = nullptr;
+    uint32_t entryNum = 0;
+};
+
+// Mapped on first use, stays mapped until exit or until the bundle is recreated
+static std::mutex gShaderBundleMutex;
+static std::array<ShaderBundle, 3> gShaderBundles;
+static std::array<bool, 3> gShaderBundleIsOpened = {};
+
+static uint64_t GetShaderBundleKey(const std::string& shaderName, nri::StageBits stage) {
+    uint64_t key = HashBytes(shaderName.data(), shaderName.size());
+    key = HashBytes(&stage, sizeof(stage), key);
+
+    return key;
+}
+
+static inline uint32_t GetShaderBundleIndex(nri::GraphicsAPI graphicsAPI) {
+    return graphicsAPI == nri::GraphicsAPI::D3D11 ? 0 : (graphicsAPI == nri::GraphicsAPI::D3D12 ? 1 : 2);
+}
+
+static std::string GetShaderBundlePath(nri::GraphicsAPI graphicsAPI) {
+    return utils::GetFullPath(std::string("Shaders") + GetShaderExt(graphicsAPI) + ".bundle", utils::DataFolder::SHADERS);
+}
+
+static const ShaderBundle& GetShaderBundle(nri::GraphicsAPI graphicsAPI) {
+    uint32_t index = GetShaderBundleIndex(graphicsAPI);
+    ShaderBundle& bundle = gShaderBundles[index];
+
+    std::lock_guard<std::mutex> lock(gShaderBundleMutex);
+
+    if (gShaderBundleIsOpened[index])
+        return bundle;
+
+    gShaderBundleIsOpened[index] = true;
+
+    std::error_code ec;
+    std::string path = GetShaderBundlePath(graphicsAPI);
+    if (!std::filesystem::exists(path, ec) || !bundle.file.Open(path))
+        return bundle;
+
+    const uint8_t* data = bundle.file.GetData();
+    size_t size = bundle.file.GetSize();
+
+    const ShaderBundleHeader* header = (const ShaderBundleHeader*)data;
+    size_t tableSize = sizeof(ShaderBundleHeader);
+    if (size >= tableSize)
+        tableSize += header->entryNum * sizeof(ShaderBundleEntry) + header->blobNum * sizeof(ShaderBundleBlob);
+
+    bool isValid = size >= tableSize && header->magic == SHADER_BUNDLE_MAGIC && header->version == SHADER_BUNDLE_VERSION;
+    if (isValid) {
+        bundle.entries = (const ShaderBundleEntry*)(header + 1);
+        bundle.blobs = (const ShaderBundleBlob*)(bundle.entries + header->entryNum);
+
+        for (uint32_t i = 0; i < header->entryNum && isValid; i++)
+            isValid = bundle.entries[i].blobIndex < header->blobNum;
+
+        for (uint32_t i = 0; i < header->blobNum && isValid; i++)
+            isValid = bundle.blobs[i].offset <= size && bundle.blobs[i].size <= size - bundle.blobs[i].offset;
+    }
+
+    if (isValid)
+        bundle.entryNum = header->entryNum;
+    else {
+        printf("ERROR: Shader bundle '%s' is corrupted!\n", path.c_str());
+
+        bundle.file.Close();
+        bundle.entries = nullptr;
+        bundle.blobs = nullptr;
+    }
+
+    return bundle;
+}
+
+// Unmaps the bundle (a mapped file can't be replaced on Windows), it gets mapped again on next use
+static void CloseShaderBundle(nri::GraphicsAPI graphicsAPI) {
+    uint32_t index = GetShaderBundleIndex(graphicsAPI);
+    ShaderBundle& bundle = gShaderBundles[index];
+
+    std::lock_guard<std::mutex> lock(gShaderBundleMutex);
+
+    bundle.file.Close();
+    bundle.entries = nullptr;
+    bundle.blobs = nullptr;
+    bundle.entryNum = 0;
+
+    gShaderBundleIsOpened[index] = false;
+}
+
+static bool FindShaderInBundle(const ShaderBundle& bundle, const std::string& shaderName, [[maybe_unused]] const std::string& path, nri::StageBits stage, const char* entryPointName, nri::ShaderDesc& shaderDesc) {
+    if (!bundle.entryNum)
+        return false;
+
+    uint64_t key = GetShaderBundleKey(shaderName, stage);
+
+    const ShaderBundleEntry* end = bundle.entries + bundle.entryNum;
+    const ShaderBundleEntry* entry = std::lower_bound(bundle.entries, end, key, [](const ShaderBundleEntry& a, uint64_t b) { return a.key < b; });
+    if (entry == end || entry->key != key)
+        return false;
+
+#if _DEBUG
+    // Stale, if the loose file exists and differs (no file system access in release builds)
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    GetFileStamp(path, sourceSize, sourceTime);
+
+    if (sourceSize != uint64_t(-1) && (sourceSize != entry->sourceSize || sourceTime != entry->sourceTime))
+        return false;
+#endif
+
+    const ShaderBundleBlob& blob = bundle.blobs[entry->blobIndex];
+
+    // Entry points are not part of the key, the requested one is passed through as for a loose file
+    shaderDesc.stage = (nri::StageBits)entry->stage;
+    shaderDesc.bytecode = bundle.file.GetData() + blob.offset;
+    shaderDesc.size = blob.size;
+    shaderDesc.entryPointName = entryPointName;
+
+    return true;
+}
+
+std::string utils::GetFullPath(const std::string& localPath, DataFolder dataFolder) {
+    // Folders are probed once (the working directory is not expected to change)
+    static const std::array<std::string, 5> folders = [] {
+        std::array<std::string, 5> result = {"", "_Shaders/", "_Data/Textures/", "_Data/Scenes/", "Tests/"};
+
+        for (std::string& path : result) {
+            for (uint32_t i = 0; i < 4; i++) {
+                if (std::filesystem::exists(path))
+                    break;
+
+                path = "../" + path;
+            }
+        }
+
+        return result;
+    }();
+
+    return folders[(size_t)dataFolder] + localPath;
+}
+
+bool utils::LoadFile(const std::string& path, std::vector<uint8_t>& data) {
+    FileView file;
+    if (!file.Open(path)) {
+        data.clear();
+        return false;
+    }
+
+    printf("Loading file '%s'...\n", GetFileName(path));
+
+    data.assign(file.GetData(), file.GetData() + file.GetSize());
+
+    return true;
+}
+
+nri::ShaderDesc utils::LoadShader(nri::GraphicsAPI graphicsAPI, const std::string& shaderName, ShaderCodeStorage& storage, const char* entryPointName) {
+    const char* ext = GetShaderExt(graphicsAPI);
+    std::string fileName = shaderName + ext;
+    nri::ShaderDesc shaderDesc = {};
+
+    size_t i = 1;
+    for (; i < gShaderExts.size(); i++) {
+        if (fileName.rfind(gShaderExts[i].ext) != std::string::npos) {
+            // Prefer the bundle, bytecode is referenced in the mapping
+            std::string path = GetFullPath(fileName, DataFolder::SHADERS);
+            if (FindShaderInBundle(GetShaderBundle(graphicsAPI), shaderName, path, gShaderExts[i].stage, entryPointName, shaderDesc))
+                break;
+
+            FileView& code = storage.emplace_back();
+
+            if (code.Open(path)) {
+                shaderDesc.stage = gShaderExts[i].stage;
+                shaderDesc.bytecode = code.GetData();
+                shaderDesc.size = code.GetSize();
+                shaderDesc.entryPointName = entryPointName;
+            }
+
+            break;
+        }
+    }
+
+    if (i == gShaderExts.size()) {
+        printf("ERROR: Shader '%s' has invalid shader extension!\n", shaderName.c_str());
+
+        NRI_ABORT_ON_FALSE(false);
+    };
+
+    return shaderDesc;
+}
+
+bool utils::CreateShaderBundle(nri::GraphicsAPI graphicsAPI) {
+    const char* ext = GetShaderExt(graphicsAPI);
+    const size_t extLength = strlen(ext);
+    std::string folder = GetFullPath("", DataFolder::SHADERS);
+    std::string bundlePath = GetShaderBundlePath(graphicsAPI);
+
+    // Gather compiled shaders (including subfolders), named by relative paths as in "LoadShader" and sorted for a deterministic blob order
+    std::vector<std::string> fileNames;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(folder, ec)) {
+        std::string fileName = entry.path().lexically_relative(folder).generic_string();
+        if (entry.is_regular_file(ec) && fileName.size() > extLength && fileName.compare(fileName.size() - extLength, extLength, ext) == 0)
+            fileNames.push_back(fileName);
+    }
+
+    std::sort(fileNames.begin(), fileNames.end());
+
+    std::vector<FileView> files;
+    std::vector<ShaderBundleEntry> entries;
+    std::vector<ShaderBundleBlob> blobs;
+    std::vector<uint32_t> blobFiles;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> blobsByHash;
+
+    files.reserve(fileNames.size());
+
+    uint64_t offset = 0;
+    for (const std::string& fileName : fileNames) {
+        size_t i = 1;
+        for (; i < gShaderExts.size(); i++) {
+            if (fileName.rfind(gShaderExts[i].ext) != std::string::npos)
+                break;
+        }
+
+        if (i == gShaderExts.size())
+            continue;
+
+        FileView& file = files.emplace_back();
+        if (!file.Open(folder + fileName))
+            return false;
+
+        uint32_t fileIndex = (uint32_t)files.size() - 1;
+
+        // Deduplicate bytecode
+        uint64_t hash = HashBytes(file.GetData(), file.GetSize());
+        std::vector<uint32_t>& sameHashBlobs = blobsByHash[hash];
+
+        uint32_t blobIndex = InvalidIndex;
+        for (uint32_t candidate : sameHashBlobs) {
+            const FileView& candidateFile = files[blobFiles[candidate]];
+            if (candidateFile.GetSize() == file.GetSize() && memcmp(candidateFile.GetData(), file.GetData(), file.GetSize()) == 0) {
+                blobIndex = candidate;
+                break;
+            }
+        }
+
+        if (blobIndex == InvalidIndex) {
+            blobIndex = (uint32_t)blobs.size();
+            blobs.push_back({offset, file.GetSize()});
+            blobFiles.push_back(fileIndex);
+            sameHashBlobs.push_back(blobIndex);
+
+            offset = helper::Align(offset + file.GetSize(), SHADER_BUNDLE_ALIGNMENT);
+        }
+
+        std::string shaderName = fileName.substr(0, fileName.size() - extLength);
+
+        ShaderBundleEntry& entry = entries.emplace_back();
+        entry.key = GetShaderBundleKey(shaderName, gShaderExts[i].stage);
+        entry.blobIndex = blobIndex;
+        GetFileStamp(folder + fileName, entry.sourceSize, entry.sourceTime);
+        entry.stage = (uint32_t)gShaderExts[i].stage;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const ShaderBundleEntry& a, const ShaderBundleEntry& b) { return a.key < b.key; });
+    for (size_t i = 1; i < entries.size(); i++) {
+        if (entries[i].key == entries[i - 1].key) {
+            printf("ERROR: Shader bundle '%s' has a key collision!\n", bundlePath.c_str());
+            return false;
+        }
+    }
+
+    // Blob offsets are relative to the data section
+    uint64_t dataOffset = sizeof(ShaderBundleHeader) + entries.size() * sizeof(ShaderBundleEntry) + blobs.size() * sizeof(ShaderBundleBlob);
+    dataOffset = helper::Align(dataOffset, SHADER_BUNDLE_ALIGNMENT);
+
+    for (ShaderBundleBlob& blob : blobs)
+        blob.offset += dataOffset;
+
+    ShaderBundleHeader header = {};
+    header.magic = SHADER_BUNDLE_MAGIC;
+    header.version = SHADER_BUNDLE_VERSION;
+    header.entryNum = (uint32_t)entries.size();
+    header.blobNum = (uint32_t)blobs.size();
+
+    // Write into a temporary file first, a partially written bundle must never be picked up
+    std::string tempPath = bundlePath + ".tmp";
+    FILE* bundleFile = fopen(tempPath.c_str(), "wb");
+    if (!bundleFile) {
+        printf("ERROR: Can't write shader bundle '%s'!\n", bundlePath.c_str());
+        return false;
+    }
+
+    bool isWritten = fwrite(&header, sizeof(header), 1, bundleFile) == 1;
+    if (!entries.empty())
+        isWritten = isWritten && fwrite(entries.data(), sizeof(ShaderBundleEntry), entries.size(), bundleFile) == entries.size();
+    if (!blobs.empty())
+        isWritten = isWritten && fwrite(blobs.data(), sizeof(ShaderBundleBlob), blobs.size(), bundleFile) == blobs.size();
+
+    static const uint8_t zeros[SHADER_BUNDLE_ALIGNMENT] = {};
+    uint64_t position = sizeof(header) + entries.size() * sizeof(ShaderBundleEntry) + blobs.size() * sizeof(ShaderBundleBlob);
+    for (size_t i = 0; i < blobs.size() && isWritten; i++) {
+        const ShaderBundleBlob& blob = blobs[i];
+        const FileView& file = files[blobFiles[i]];
+
+        isWritten = fwrite(zeros, 1, (size_t)(blob.offset - position), bundleFile) == blob.offset - position;
+        isWritten = isWritten && fwrite(file.GetData(), 1, file.GetSize(), bundleFile) == file.GetSize();
+
+        position = blob.offset + blob.size;
+    }
+
+    isWritten = fclose(bundleFile) == 0 && isWritten;
+
+    if (isWritten) {
+        CloseShaderBundle(graphicsAPI);
+        std::filesystem::rename(tempPath, bundlePath, ec);
+    }
+
+    if (!isWritten || ec) {
+        std::filesystem::remove(tempPath, ec);
+        printf("ERROR: Can't write shader bundle '%s'!\n", bundlePath.c_str());
+
+        return false;
+    }
+
+    printf("Shader bundle '%s': %u shaders, %u unique\n", GetFileName(bundlePath), (uint32_t)entries.size(), (uint32_t)blobs.size());
+
+    return true;
+}
+
+namespace utils {
+static void PostProcessTexture(const std::string& name, Texture& texture, bool computeAvgColorAndAlphaMode, detexTexture** dTexture, int mipNum, uint32_t alphaScanMipSize) {
+    texture.mips = (Mip*)dTexture;
+    texture.name = name;
+    texture.format = GetFormatNRI(dTexture[0]->format);
+    texture.width = (uint16_t)dTexture[0]->width;
+    texture.height = (uint16_t)dTexture[0]->height;
+    texture.mipNum = (uint8_t)mipNum;
+
+    // TODO: detex doesn't support cubemaps and 3D textures
+    texture.layerNum = 1;
+    texture.depth = 1;
+
+    texture.alphaMode = AlphaMode::OPAQUE;
+    if (computeAvgColorAndAlphaMode) {
+        // Alpha mode
+        if (texture.format == nri::Format::BC1_RGBA_UNORM || texture.format == nri::Format::BC1_RGBA_SRGB) {
+            // Finer mips of a streamed texture are not paged in
+            uint32_t maxMipSize = texture.file.IsMapped() && alphaScanMipSize ? alphaScanMipSize : uint32_t(-1);
+
+            bool hasTransparency = false;
+            for (int i = mipNum - 1; i >= 0 && !hasTransparency; i--) {
+                if (i != mipNum - 1 && (uint32_t)max(dTexture[i]->width, dTexture[i]->height) > maxMipSize)
+                    break;
+
+                const size_t size = detexTextureSize(dTexture[i]->width_in_blocks, dTexture[i]->height_in_blocks, dTexture[i]->format);
+                const uint8_t* bc1 = dTexture[i]->data;
 
                 for (size_t j = 0; j < size && !hasTransparency; j += 8) {
                     const uint16_t* c = (uint16_t*)bc1;
@@ -457,293 +2037,1576 @@ static void PostProcessTexture(const std::string& name, Texture& texture, bool c
                 }
             }
 
-            if (hasTransparency)
-                texture.alphaMode = AlphaMode::PREMULTIPLIED;
+            if (hasTransparency)
+                texture.alphaMode = AlphaMode::PREMULTIPLIED;
+        }
+
+        // Decompress last mip
+        std::vector<uint8_t> image;
+        detexTexture* lastMip = dTexture[mipNum - 1];
+        uint8_t* rgba8 = lastMip->data;
+        if (lastMip->format != DETEX_PIXEL_FORMAT_RGBA8) {
+            // Convert to RGBA8 if the texture is compressed
+            image.resize(lastMip->width * lastMip->height * detexGetPixelSize(DETEX_PIXEL_FORMAT_RGBA8));
+            detexDecompressTextureLinear(lastMip, &image[0], DETEX_PIXEL_FORMAT_RGBA8);
+            rgba8 = &image[0];
+        }
+
+        // Average color
+        float4 avgColor = float4::Zero();
+        const size_t pixelNum = lastMip->width * lastMip->height;
+        for (size_t i = 0; i < pixelNum; i++)
+            avgColor += Packing::unorm_to_float4<8, 8, 8, 8>(*(uint32_t*)(rgba8 + i * 4));
+        avgColor /= float(pixelNum);
+
+        if (texture.alphaMode != AlphaMode::PREMULTIPLIED && avgColor.w < 254.0f / 255.0f)
+            texture.alphaMode = AlphaMode::TRANSPARENT;
+
+        if (texture.alphaMode == AlphaMode::TRANSPARENT && avgColor.w == 0.0f) {
+            printf("WARNING: Texture '%s' is fully transparent!\n", name.c_str());
+            texture.alphaMode = AlphaMode::OFF;
+        }
+    }
+}
+} // namespace utils
+
+bool utils::LoadTextureFromMemory(const std::string& name, const uint8_t* data, int dataSize,
+    Texture& texture, bool computeAvgColorAndAlphaMode) {
+    printf("Loading embedded texture '%s'...\n", name.c_str());
+
+    int x, y, comp;
+    unsigned char* image = stbi_load_from_memory((stbi_uc const*)data, dataSize, &x, &y, &comp, STBI_rgb_alpha);
+    if (!image) {
+        printf("Could not read memory for embedded texture %s. Reason: %s", name.c_str(), stbi_failure_reason());
+        return false;
+    }
+    detexTexture** dTexture = (detexTexture**)malloc(sizeof(detexTexture*));
+    dTexture[0] = (detexTexture*)malloc(sizeof(detexTexture));
+    dTexture[0]->format = DETEX_PIXEL_FORMAT_RGBA8;
+    dTexture[0]->width = x;
+    dTexture[0]->height = y;
+    dTexture[0]->width_in_blocks = x;
+    dTexture[0]->height_in_blocks = y;
+    dTexture[0]->data = image; // "stbi_image_free" is "free"
+
+    const int kMipNum = 1;
+    PostProcessTexture(name, texture, computeAvgColorAndAlphaMode, dTexture, kMipNum, 0);
+    return true;
+}
+
+// Mirrors "detexLoadDDSFileWithMipmaps", but mips reference the file contents instead of copies
+static bool LoadDdsFromFile(const utils::FileView& file, int maxMipNum, detexTexture*** dTextureOut, int* mipNumOut) {
+    const uint8_t* data = file.GetData();
+    const size_t size = file.GetSize();
+
+    if (size < 128 || memcmp(data, "DDS ", 4) != 0)
+        return false;
+
+    const uint8_t* header = data + 4;
+    uint32_t width = *(uint32_t*)(header + 12);
+    uint32_t height = *(uint32_t*)(header + 8);
+    uint32_t flags = *(uint32_t*)(header + 4);
+    uint32_t pixelFormatFlags = *(uint32_t*)(header + 76);
+    uint32_t bitCount = *(uint32_t*)(header + 84);
+    uint32_t redMask = *(uint32_t*)(header + 88);
+    uint32_t greenMask = *(uint32_t*)(header + 92);
+    uint32_t blueMask = *(uint32_t*)(header + 96);
+    uint32_t alphaMask = *(uint32_t*)(header + 100);
+
+    char fourCC[5] = {};
+    memcpy(fourCC, header + 80, 4);
+
+    size_t offset = 128;
+    uint32_t dx10Format = 0;
+    if (strncmp(fourCC, "DX10", 4) == 0) {
+        if (size < offset + 20)
+            return false;
+
+        const uint32_t* dx10Header = (uint32_t*)(data + offset);
+        if (dx10Header[1] != 3) // only 2D textures
+            return false;
+
+        dx10Format = dx10Header[0];
+        offset += 20;
+    }
+
+    const detexTextureFileInfo* info = detexLookupDDSFileInfo(fourCC, dx10Format, pixelFormatFlags, bitCount, redMask, greenMask, blueMask, alphaMask);
+    if (!info)
+        return false;
+
+    uint32_t bytesPerBlock = detexFormatIsCompressed(info->texture_format) ? detexGetCompressedBlockSize(info->texture_format) : detexGetPixelSize(info->texture_format);
+    uint32_t blockWidth = info->block_width;
+    uint32_t blockHeight = info->block_height;
+
+    int mipNum = (flags & 0x20000) ? max(*(int32_t*)(header + 24), 1) : 1;
+    mipNum = min(mipNum, maxMipNum);
+
+    detexTexture** dTexture = (detexTexture**)malloc(sizeof(detexTexture*) * mipNum);
+    for (int i = 0; i < mipNum; i++) {
+        uint32_t widthInBlocks = (width + blockWidth - 1) / blockWidth;
+        uint32_t heightInBlocks = (height + blockHeight - 1) / blockHeight;
+        size_t mipSize = (size_t)widthInBlocks * heightInBlocks * bytesPerBlock;
+
+        if (offset + mipSize > size) {
+            for (int j = 0; j < i; j++)
+                free(dTexture[j]);
+            free(dTexture);
+
+            return false;
+        }
+
+        dTexture[i] = (detexTexture*)malloc(sizeof(detexTexture));
+        dTexture[i]->format = info->texture_format;
+        dTexture[i]->data = (uint8_t*)(data + offset);
+        dTexture[i]->width = (int)width;
+        dTexture[i]->height = (int)height;
+        dTexture[i]->width_in_blocks = (int)widthInBlocks;
+        dTexture[i]->height_in_blocks = (int)heightInBlocks;
+
+        offset += mipSize;
+        width = max(width >> 1, 1u);
+        height = max(height >> 1, 1u);
+    }
+
+    *dTextureOut = dTexture;
+    *mipNumOut = mipNum;
+
+    return true;
+}
+
+// Case-insensitive, "ext" must be in lower case
+static bool HasExtension(const std::string& path, const char* ext) {
+    size_t extLen = strlen(ext);
+    if (path.size() < extLen)
+        return false;
+
+    const char* pathExt = path.c_str() + path.size() - extLen;
+    for (size_t i = 0; i < extLen; i++) {
+        char c = pathExt[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+
+        if (c != ext[i])
+            return false;
+    }
+
+    return true;
+}
+
+bool utils::LoadTexture(const std::string& path, Texture& texture, bool computeAvgColorAndAlphaMode, uint32_t alphaScanMipSize) {
+    printf("Loading texture '%s'...\n", GetFileName(path));
+
+    detexTexture** dTexture = nullptr;
+    int mipNum = 0;
+
+    bool isLoaded = false;
+    if (HasExtension(path, ".dds")) {
+        FileView file;
+        if (file.Open(path) && LoadDdsFromFile(file, 32, &dTexture, &mipNum)) {
+            texture.file = std::move(file);
+            isLoaded = true;
+        }
+    } else if (HasExtension(path, ".ktx"))
+        isLoaded = detexLoadTextureFileWithMipmaps(path.c_str(), 32, &dTexture, &mipNum);
+    else {
+        FileView file;
+        if (file.Open(path)) {
+            int x, y, comp;
+            uint8_t* image = stbi_load_from_memory(file.GetData(), (int)file.GetSize(), &x, &y, &comp, STBI_rgb_alpha);
+            if (image) {
+                dTexture = (detexTexture**)malloc(sizeof(detexTexture*));
+                dTexture[0] = (detexTexture*)malloc(sizeof(detexTexture));
+                dTexture[0]->format = DETEX_PIXEL_FORMAT_RGBA8;
+                dTexture[0]->data = image; // "stbi_image_free" is "free"
+                dTexture[0]->width = x;
+                dTexture[0]->height = y;
+                dTexture[0]->width_in_blocks = x;
+                dTexture[0]->height_in_blocks = y;
+
+                mipNum = 1;
+                isLoaded = true;
+            }
+        }
+    }
+
+    if (!isLoaded) {
+        printf("ERROR: Can't load texture '%s'\n", path.c_str());
+
+        return false;
+    }
+
+    PostProcessTexture(path, texture, computeAvgColorAndAlphaMode, dTexture, mipNum, alphaScanMipSize);
+
+    return true;
+}
+
+void utils::LoadTextureFromMemory(nri::Format format, uint32_t width, uint32_t height, const uint8_t* pixels, Texture& texture) {
+    assert(format == nri::Format::R8_UNORM);
+
+    detexTexture** dTexture;
+    detexLoadTextureFromMemory(DETEX_PIXEL_FORMAT_R8, width, height, pixels, &dTexture);
+
+    texture.mipNum = 1;
+    texture.layerNum = 1;
+    texture.depth = 1;
+    texture.format = format;
+    texture.alphaMode = AlphaMode::OPAQUE;
+    texture.mips = (Mip*)dTexture;
+}
+
+static const char* cgltfErrorToString(cgltf_result res) {
+    switch (res) {
+        case cgltf_result_success:
+            return "Success";
+        case cgltf_result_data_too_short:
+            return "Data is too short";
+        case cgltf_result_unknown_format:
+            return "Unknown format";
+        case cgltf_result_invalid_json:
+            return "Invalid JSON";
+        case cgltf_result_invalid_gltf:
+            return "Invalid GLTF";
+        case cgltf_result_invalid_options:
+            return "Invalid options";
+        case cgltf_result_file_not_found:
+            return "File not found";
+        case cgltf_result_io_error:
+            return "I/O error";
+        case cgltf_result_out_of_memory:
+            return "Out of memory";
+        case cgltf_result_legacy_gltf:
+            return "Legacy GLTF";
+        default:
+            return "Unknown error";
+    }
+}
+
+static std::pair<const uint8_t*, size_t> cgltfBufferIterator(const cgltf_accessor* accessor, size_t defaultStride) {
+    if (!accessor)
+        return std::make_pair(nullptr, 0);
+
+    // TODO: sparse accessor support
+    const cgltf_buffer_view* view = accessor->buffer_view;
+    const uint8_t* data = (uint8_t*)view->buffer->data + view->offset + accessor->offset;
+    const size_t stride = view->stride ? view->stride : defaultStride;
+
+    return std::make_pair(data, stride);
+}
+
+// GLTF only support DDS images through the MSFT_texture_dds extension.
+// Since cgltf does not support this extension, we parse the custom extension string as json here.
+// See https://github.com/KhronosGroup/GLTF/tree/master/extensions/2.0/Vendor/MSFT_texture_dds
+static const cgltf_image* ParseDdsImage(const cgltf_texture* texture, const cgltf_data* objects) {
+    for (size_t i = 0; i < texture->extensions_count; i++) {
+        const cgltf_extension& ext = texture->extensions[i];
+
+        if (!ext.name || !ext.data)
+            continue;
+
+        if (strcmp(ext.name, "MSFT_texture_dds") != 0)
+            continue;
+
+        size_t extensionLength = strlen(ext.data);
+        if (extensionLength > 1024)
+            return nullptr; // safeguard against weird inputs
+
+        jsmn_parser parser;
+        jsmn_init(&parser);
+
+        // count the tokens, normally there are 3
+        int numTokens = jsmn_parse(&parser, ext.data, extensionLength, nullptr, 0);
+
+        // allocate the tokens on the stack
+        jsmntok_t* tokens = (jsmntok_t*)alloca(numTokens * sizeof(jsmntok_t));
+
+        // reset the parser and prse
+        jsmn_init(&parser);
+        int numParsed = jsmn_parse(&parser, ext.data, extensionLength, tokens, numTokens);
+        if (numParsed != numTokens)
+            goto fail;
+
+        if (tokens[0].type != JSMN_OBJECT)
+            goto fail; // expecting that the extension is an object
+
+        for (int k = 1; k < numTokens; k++) {
+            if (tokens[k].type != JSMN_STRING)
+                goto fail; // expecting a string key
+
+            if (cgltf_json_strcmp(tokens + k, (const uint8_t*)ext.data, "source") == 0) {
+                ++k;
+                int index = cgltf_json_to_int(tokens + k, (const uint8_t*)ext.data);
+                if (index < 0)
+                    goto fail; // expecting a non-negative integer; non-value results in CGLTF_ERROR_JSON which is negative
+
+                if (size_t(index) >= objects->images_count) {
+                    printf("WARNING: Invalid image index %d specified in GLTF texture definition\n", index);
+                    return nullptr;
+                }
+
+                return objects->images + index;
+            }
+
+            // this was something else - skip it
+            k = cgltf_skip_json(tokens, k);
+        }
+
+    fail:
+        printf("WARNING: Failed to parse the DDS GLTF extension: %s\n", ext.data);
+        return nullptr;
+    }
+
+    return nullptr;
+}
+
+static void DecomposeAffine(const float4x4& transform, float3& translation, float4& rotation, float3& scale) {
+    translation = transform.Col(3).xyz;
+
+    float3 col0 = transform.Col(0).xyz;
+    float3 col1 = transform.Col(1).xyz;
+    float3 col2 = transform.Col(2).xyz;
+
+    scale.x = length(col0);
+    scale.y = length(col1);
+    scale.z = length(col2);
+    if (scale.x > 0.f)
+        col0 /= scale.x;
+    if (scale.y > 0.f)
+        col1 /= scale.y;
+    if (scale.z > 0.f)
+        col2 /= scale.z;
+
+    float3 zAxis = cross(col0, col1);
+    if (dot(zAxis, col2) < 0.0f) {
+        scale.x = -scale.x;
+        col0 = -col0;
+    }
+
+    // https://www.euclideanspace.com/maths/geometry/rotations/conversions/matrixToQuaternion/
+    rotation.w = sqrt(max(0.0f, 1.0f + col0.x + col1.y + col2.z)) * 0.5f;
+    rotation.x = sqrt(max(0.0f, 1.0f + col0.x - col1.y - col2.z)) * 0.5f;
+    rotation.y = sqrt(max(0.0f, 1.0f - col0.x + col1.y - col2.z)) * 0.5f;
+    rotation.z = sqrt(max(0.0f, 1.0f - col0.x - col1.y + col2.z)) * 0.5f;
+    rotation.x = std::copysign(rotation.x, col2.y - col1.z);
+    rotation.y = std::copysign(rotation.y, col0.z - col2.x);
+    rotation.z = std::copysign(rotation.z, col1.x - col0.y);
+}
+
+static inline bool IsGltfPrimitiveSupported(const cgltf_primitive& primitive) {
+    return (primitive.type == cgltf_primitive_type_triangles || primitive.type == cgltf_primitive_type_lines) && primitive.attributes_count > 0;
+}
+
+static inline void GetBasis(float3 N, float3& T, float3& B) {
+    float sz = sign(N.z);
+    float a = 1.0f / (sz + N.z);
+    float ya = N.y * a;
+    float b = N.x * ya;
+    float c = N.x * sz;
+
+    T = float3(c * N.x * a - 1.0f, sz * b, c);
+    B = float3(b, N.y * ya - sz, N.y);
+}
+
+static inline void SetVertex(utils::Scene& scene, uint32_t i, const float3& p, const float2& uv, const float3& N, const float3& T) {
+    if (i < scene.unpackedVertices.size()) {
+        utils::UnpackedVertex& v = scene.unpackedVertices[i];
+        v.pos[0] = p.x;
+        v.pos[1] = p.y;
+        v.pos[2] = p.z;
+        v.uv[0] = uv.x;
+        v.uv[1] = uv.y;
+        v.N[0] = N.x;
+        v.N[1] = N.y;
+        v.N[2] = N.z;
+        v.T[0] = T.x;
+        v.T[1] = T.y;
+        v.T[2] = T.z;
+    }
+
+    utils::Vertex& vp = scene.vertices[i];
+    vp.pos[0] = p.x;
+    vp.pos[1] = p.y;
+    vp.pos[2] = p.z;
+    vp.uv = float2(uv);
+    vp.N = Packing::float4_to_unorm<10, 10, 10, 2>(float4(N * 0.5f + 0.5f, 0.0f));
+    vp.T = Packing::float4_to_unorm<10, 10, 10, 2>(float4(T * 0.5f + 0.5f, 0.0f));
+}
+
+struct SceneTextureRequest {
+    std::string path;              // file path or a name of an embedded image
+    const uint8_t* data = nullptr; // embedded image, if not "nullptr"
+    size_t dataSize = 0;
+    utils::Texture* texture = nullptr;
+    bool computeAlphaMode = false;
+    bool makeSRGB = false;
+};
+
+struct SceneMaterialTextures {
+    uint32_t requestIndices[4] = {utils::InvalidIndex, utils::InvalidIndex, utils::InvalidIndex, utils::InvalidIndex};
+    bool useTransmission = false;
+    bool isAlphaOff = false;
+};
+
+struct utils::SceneLoadingContext {
+    ~SceneLoadingContext() {
+        if (thread.joinable())
+            thread.join();
+
+        // Not committed into the scene
+        for (SceneTextureRequest& request : textureRequests)
+            delete request.texture;
+
+        if (objects)
+            cgltf_free(objects);
+    }
+
+    inline void SetStageTotal(utils::SceneLoadingStage stage, uint32_t num) {
+        progressTotal[(size_t)stage] = num;
+    }
+
+    inline void AdvanceStage(utils::SceneLoadingStage stage) {
+        progressDone[(size_t)stage]++;
+    }
+
+    inline void CompleteStage(utils::SceneLoadingStage stage) {
+        uint32_t num = max(progressTotal[(size_t)stage].load(), 1u);
+
+        progressTotal[(size_t)stage] = num;
+        progressDone[(size_t)stage] = num;
+    }
+
+    std::string path;
+    utils::LoadSceneDesc desc = {};
+    utils::Scene* scene = nullptr;
+
+    // Texture requests reference the contents of these, which must stay alive until textures are decoded
+    std::vector<utils::FileView> files;
+    utils::FileView cacheFile;
+    cgltf_data* objects = nullptr;
+
+    std::vector<SceneTextureRequest> textureRequests;
+    std::vector<SceneMaterialTextures> materialTextures;
+    size_t materialOffset = 0;
+
+    std::thread thread;
+    std::atomic_uint32_t progressDone[(size_t)utils::SceneLoadingStage::MAX_NUM] = {};
+    std::atomic_uint32_t progressTotal[(size_t)utils::SceneLoadingStage::MAX_NUM] = {};
+    std::atomic_bool isGeometryReady = false;
+    std::atomic_bool isDone = false;
+    bool result = false;
+    bool isCommitted = false;
+};
+
+static void LoadStaticTextures(utils::Scene& scene) {
+    { // StaticTexture::Black
+        utils::Texture* texture = new utils::Texture;
+        const std::string& texPath = utils::GetFullPath("black.png", utils::DataFolder::TEXTURES);
+        NRI_ABORT_ON_FALSE(utils::LoadTexture(texPath, *texture));
+        scene.textures.push_back(texture);
+    }
+
+    { // StaticTexture::White
+        utils::Texture* texture = new utils::Texture;
+        const std::string& texPath = utils::GetFullPath("white.png", utils::DataFolder::TEXTURES);
+        NRI_ABORT_ON_FALSE(utils::LoadTexture(texPath, *texture));
+        scene.textures.push_back(texture);
+    }
+
+    { // StaticTexture::Invalid
+        utils::Texture* texture = new utils::Texture;
+        const std::string& texPath = utils::GetFullPath("checkerboard0.dds", utils::DataFolder::TEXTURES);
+        NRI_ABORT_ON_FALSE(utils::LoadTexture(texPath, *texture, true));
+        scene.textures.push_back(texture);
+    }
+
+    { // StaticTexture::FlatNormal
+        utils::Texture* texture = new utils::Texture;
+        const std::string& texPath = utils::GetFullPath("flatnormal.png", utils::DataFolder::TEXTURES);
+        NRI_ABORT_ON_FALSE(utils::LoadTexture(texPath, *texture));
+        scene.textures.push_back(texture);
+    }
+
+    // TODO: Metal complains that "RGBA8_UINT" can't be cast to "float" despite the fact that all static textures are
+    // never accessed as material textures for objects rendering. Better separate static textures and material textures
+#if (NRIF_PLATFORM == NRIF_COCOA)
+    constexpr bool overrideFormat = false;
+#else
+    constexpr bool overrideFormat = true;
+#endif
+
+    // StaticTexture::ScramblingRanking (all)
+    for( uint32_t i = 2; i <= 8; i++)
+    {
+        char s[256];
+        snprintf(s, sizeof(s), "scrambling_ranking_128x128_2d_%uspp.png", 1 << i);
+
+        utils::Texture* texture = new utils::Texture;
+        const std::string& texPath = utils::GetFullPath(s, utils::DataFolder::TEXTURES);
+        NRI_ABORT_ON_FALSE(utils::LoadTexture(texPath, *texture));
+        if (overrideFormat)
+            texture->OverrideFormat(nri::Format::RGBA8_UINT);
+        scene.textures.push_back(texture);
+    }
+
+    { // StaticTexture::SobolSequence
+        utils::Texture* texture = new utils::Texture;
+        const std::string& texPath = utils::GetFullPath("sobol_256_4d.png", utils::DataFolder::TEXTURES);
+        NRI_ABORT_ON_FALSE(utils::LoadTexture(texPath, *texture));
+        if (overrideFormat)
+            texture->OverrideFormat(nri::Format::RGBA8_UINT);
+        scene.textures.push_back(texture);
+    }
+}
+
+static void DecodeSceneTextures(utils::SceneLoadingContext& context) {
+    std::vector<SceneTextureRequest>& requests = context.textureRequests;
+    context.SetStageTotal(utils::SceneLoadingStage::TEXTURES, (uint32_t)requests.size());
+
+    // Finer mips of streamed textures are left untouched
+    uint32_t alphaScanMipSize = context.desc.textureStreamer ? context.desc.textureStreamer->GetTailMipSize() : 0;
+
+    // Decode unique textures in parallel
+    utils::ParallelFor((uint32_t)requests.size(), 1, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t i = begin; i < end; i++) {
+            SceneTextureRequest& request = requests[i];
+
+            utils::Texture* tex = new utils::Texture;
+
+            bool isLoaded = false;
+            if (request.data) {
+                assert(request.dataSize < std::numeric_limits<int>::max());
+
+                isLoaded = utils::LoadTextureFromMemory(request.path, request.data, (int)request.dataSize, *tex, request.computeAlphaMode);
+            } else {
+                isLoaded = utils::LoadTexture(request.path, *tex, request.computeAlphaMode, alphaScanMipSize);
+                if (!isLoaded) {
+                    std::string pathDDS = request.path.substr(0, request.path.find_last_of('.')) + ".dds";
+                    isLoaded = utils::LoadTexture(pathDDS, *tex, request.computeAlphaMode, alphaScanMipSize);
+                }
+            }
+
+            if (isLoaded) {
+                if (request.makeSRGB)
+                    tex->OverrideFormat(MakeSRGBFormat(tex->format));
+
+                request.texture = tex;
+            } else
+                delete tex;
+
+            context.AdvanceStage(utils::SceneLoadingStage::TEXTURES);
         }
+    });
 
-        // Decompress last mip
-        std::vector<uint8_t> image;
-        detexTexture* lastMip = dTexture[mipNum - 1];
-        uint8_t* rgba8 = lastMip->data;
-        if (lastMip->format != DETEX_PIXEL_FORMAT_RGBA8) {
-            // Convert to RGBA8 if the texture is compressed
-            image.resize(lastMip->width * lastMip->height * detexGetPixelSize(DETEX_PIXEL_FORMAT_RGBA8));
-            detexDecompressTextureLinear(lastMip, &image[0], DETEX_PIXEL_FORMAT_RGBA8);
-            rgba8 = &image[0];
+    context.CompleteStage(utils::SceneLoadingStage::TEXTURES);
+}
+
+// Texture indices equal to "InvalidIndex" are not ready yet, materials use static textures instead
+static void ResolveSceneMaterials(utils::SceneLoadingContext& context, const std::vector<uint32_t>& textureIndices) {
+    utils::Scene& scene = *context.scene;
+
+    for (size_t i = 0; i < context.materialTextures.size(); i++) {
+        utils::Material& material = scene.materials[context.materialOffset + i];
+        const SceneMaterialTextures& textures = context.materialTextures[i];
+
+        uint32_t* materialTextureIndices = &material.baseColorTexIndex;
+        for (uint32_t j = 0; j < 4; j++) {
+            uint32_t requestIndex = textures.requestIndices[j];
+            if (requestIndex != utils::InvalidIndex && textureIndices[requestIndex] != utils::InvalidIndex)
+                materialTextureIndices[j] = textureIndices[requestIndex];
         }
 
-        // Average color
-        float4 avgColor = float4::Zero();
-        const size_t pixelNum = lastMip->width * lastMip->height;
-        for (size_t i = 0; i < pixelNum; i++)
-            avgColor += Packing::unorm_to_float4<8, 8, 8, 8>(*(uint32_t*)(rgba8 + i * 4));
-        avgColor /= float(pixelNum);
+        if (material.emissiveTexIndex == utils::StaticTexture::Black && (material.emissiveAndRoughnessScale.x != 0.0f || material.emissiveAndRoughnessScale.y != 0.0f || material.emissiveAndRoughnessScale.z != 0.0f))
+            material.emissiveTexIndex = utils::StaticTexture::White;
 
-        if (texture.alphaMode != AlphaMode::PREMULTIPLIED && avgColor.w < 254.0f / 255.0f)
-            texture.alphaMode = AlphaMode::TRANSPARENT;
+        if (material.baseColorTexIndex == utils::StaticTexture::Black && (material.baseColorAndMetalnessScale.x != 0.0f || material.baseColorAndMetalnessScale.y != 0.0f || material.baseColorAndMetalnessScale.z != 0.0f))
+            material.baseColorTexIndex = utils::StaticTexture::White;
 
-        if (texture.alphaMode == AlphaMode::TRANSPARENT && avgColor.w == 0.0f) {
-            printf("WARNING: Texture '%s' is fully transparent!\n", name.c_str());
-            texture.alphaMode = AlphaMode::OFF;
+        if (material.roughnessMetalnessTexIndex == utils::StaticTexture::Black && (material.emissiveAndRoughnessScale.w != 0.0f || material.baseColorAndMetalnessScale.w != 0.0f))
+            material.roughnessMetalnessTexIndex = utils::StaticTexture::White;
+
+        const utils::Texture* diffuseTexture = scene.textures[material.baseColorTexIndex];
+        material.alphaMode = textures.useTransmission ? utils::AlphaMode::TRANSPARENT : diffuseTexture->alphaMode;
+
+        if (textures.isAlphaOff)
+            material.alphaMode = utils::AlphaMode::OFF;
+    }
+}
+
+static void CommitSceneTextures(utils::SceneLoadingContext& context) {
+    utils::Scene& scene = *context.scene;
+    std::vector<SceneTextureRequest>& requests = context.textureRequests;
+
+    // Gather textures in request order to keep indices deterministic
+    scene.textures.reserve(scene.textures.size() + requests.size());
+
+    std::vector<uint32_t> textureIndices(requests.size(), utils::StaticTexture::Black);
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (requests[i].texture) {
+            textureIndices[i] = (uint32_t)scene.textures.size();
+            scene.textures.push_back(requests[i].texture);
+
+            if (context.desc.textureStreamer) {
+                context.desc.textureStreamer->Register(*requests[i].texture);
+                scene.textureStreamer = context.desc.textureStreamer;
+            }
+
+            requests[i].texture = nullptr;
+        }
+    }
+
+    ResolveSceneMaterials(context, textureIndices);
+
+    context.isCommitted = true;
+}
+
+//========================================================================================================================
+// SCENE CACHE
+//========================================================================================================================
+
+// A binary snapshot of a loaded scene stored next to the source asset. Arrays are aligned within the file, i.e. a mapped
+// cache is copied into the scene with a single "memcpy" per array. Bump the version if any cached structure changes!
+constexpr uint32_t SCENE_CACHE_MAGIC = 0x4E435343; // "CSCN"
+constexpr uint32_t SCENE_CACHE_VERSION = 14;
+constexpr size_t SCENE_CACHE_ALIGNMENT = 16;
+constexpr uint32_t SCENE_CACHE_FLAG_ALLOW_UPDATE = 0x1;
+constexpr uint32_t SCENE_CACHE_FLAG_16BIT_INDICES = 0x2;
+constexpr uint32_t SCENE_CACHE_FLAG_OPTIMIZE_MESHES = 0x4;
+constexpr uint32_t SCENE_CACHE_FLAG_COMPACT_VERTICES = 0x8;
+constexpr uint32_t SCENE_CACHE_FLAG_UNPACKED_VERTICES = 0x10;
+constexpr uint32_t SCENE_CACHE_FLAG_VERTEX_STREAMS = 0x20;
+constexpr uint32_t SCENE_CACHE_FLAG_SPARSE_MORPH_TARGETS = 0x40;
+constexpr uint32_t SCENE_CACHE_FLAG_COMPRESSED_ANIMATIONS = 0x80;
+
+struct SceneCacheHeader {
+    uint32_t magic = SCENE_CACHE_MAGIC;
+    uint32_t version = SCENE_CACHE_VERSION;
+    uint64_t layoutHash = 0;
+    uint64_t sourceHash = 0;
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    uint32_t flags = 0;
+    uint32_t meshletLimits = 0; // max vertices and primitives, 16 bits each
+    uint32_t lodNum = 0;
+    uint32_t reserved = 0;
+};
+
+class SceneCacheWriter {
+public:
+    SceneCacheWriter(FILE* file)
+        : m_File(file) {
+    }
+
+    inline bool IsValid() const {
+        return m_IsValid;
+    }
+
+    void WriteBytes(const void* data, size_t size) {
+        if (size && fwrite(data, 1, size, m_File) != size)
+            m_IsValid = false;
+
+        m_Offset += size;
+    }
+
+    void Align() {
+        static const uint8_t zeros[SCENE_CACHE_ALIGNMENT] = {};
+        WriteBytes(zeros, helper::Align(m_Offset, SCENE_CACHE_ALIGNMENT) - m_Offset);
+    }
+
+    template <typename T>
+    inline void Write(const T& value) {
+        WriteBytes(&value, sizeof(T));
+    }
+
+    template <typename T>
+    void WriteArray(const std::vector<T>& values) {
+        Write((uint64_t)values.size());
+        Align();
+        WriteBytes(values.data(), values.size() * sizeof(T));
+    }
+
+    void WriteString(const std::string& s) {
+        Write((uint32_t)s.size());
+        WriteBytes(s.data(), s.size());
+    }
+
+private:
+    FILE* m_File = nullptr;
+    size_t m_Offset = 0;
+    bool m_IsValid = true;
+};
+
+class SceneCacheReader {
+public:
+    SceneCacheReader(const uint8_t* data, size_t size)
+        : m_Data(data), m_Size(size) {
+    }
+
+    inline bool IsValid() const {
+        return m_IsValid;
+    }
+
+    inline void SetInvalid() {
+        m_IsValid = false;
+    }
+
+    const uint8_t* ReadBytes(size_t size) {
+        if (!m_IsValid || size > m_Size - m_Offset) {
+            m_IsValid = false;
+            return nullptr;
+        }
+
+        const uint8_t* data = m_Data + m_Offset;
+        m_Offset += size;
+
+        return data;
+    }
+
+    void Align() {
+        size_t offset = helper::Align(m_Offset, SCENE_CACHE_ALIGNMENT);
+        if (offset > m_Size)
+            m_IsValid = false;
+        else
+            m_Offset = offset;
+    }
+
+    template <typename T>
+    T Read() {
+        T value = {};
+
+        const uint8_t* data = ReadBytes(sizeof(T));
+        if (data)
+            memcpy(&value, data, sizeof(T));
+
+        return value;
+    }
+
+    // An element count, which can't exceed the number of remaining bytes
+    uint32_t ReadNum() {
+        uint32_t num = Read<uint32_t>();
+        if (num > m_Size - m_Offset) {
+            m_IsValid = false;
+            num = 0;
+        }
+
+        return num;
+    }
+
+    template <typename T>
+    void ReadArray(std::vector<T>& values) {
+        uint64_t num = Read<uint64_t>();
+        Align();
+
+        const T* data = nullptr;
+        if (num <= (m_Size - m_Offset) / sizeof(T))
+            data = (const T*)ReadBytes((size_t)num * sizeof(T));
+        else
+            m_IsValid = false;
+
+        if (data)
+            values.assign(data, data + num);
+        else
+            values.clear();
+    }
+
+    std::string ReadString() {
+        uint32_t size = Read<uint32_t>();
+
+        const char* data = (const char*)ReadBytes(size);
+
+        return data ? std::string(data, size) : std::string();
+    }
+
+private:
+    const uint8_t* m_Data = nullptr;
+    size_t m_Size = 0;
+    size_t m_Offset = 0;
+    bool m_IsValid = true;
+};
+
+static std::string GetRelativePath(const std::filesystem::path& path, const std::filesystem::path& folder) {
+    std::filesystem::path relativePath = path.lexically_relative(folder);
+
+    return relativePath.empty() ? path.string() : relativePath.string();
+}
+
+// "sourceHash" is left zero, since hashing touches every page of the mapped source
+static SceneCacheHeader GetSceneCacheHeader(const std::filesystem::path& path, const utils::LoadSceneDesc& loadSceneDesc) {
+    // Struct sizes catch most layout changes
+    const uint64_t layout[] = {
+        sizeof(utils::Vertex),
+        sizeof(utils::CompactVertex),
+        sizeof(utils::VertexPosition),
+        sizeof(utils::VertexAttributes),
+        sizeof(utils::UnpackedVertex),
+        sizeof(utils::Index),
+        sizeof(utils::Primitive),
+        sizeof(utils::MorphVertex),
+        sizeof(utils::MorphTarget),
+        sizeof(utils::MorphDelta),
+        sizeof(utils::Material),
+        sizeof(utils::Instance),
+        sizeof(utils::Mesh),
+        sizeof(utils::Meshlet),
+        sizeof(utils::MeshLod),
+        sizeof(utils::MeshInstance),
+        sizeof(utils::MorphTargetIndexWeight),
+        sizeof(utils::WeightTrackMorphMeshIndex),
+        sizeof(SceneMaterialTextures),
+        sizeof(float4x4),
+        sizeof(cBoxf),
+    };
+
+    SceneCacheHeader header = {};
+    header.layoutHash = HashBytes(layout, sizeof(layout));
+    header.flags = loadSceneDesc.allowUpdate ? SCENE_CACHE_FLAG_ALLOW_UPDATE : 0;
+    header.flags |= loadSceneDesc.allow16BitIndices ? SCENE_CACHE_FLAG_16BIT_INDICES : 0;
+    header.flags |= loadSceneDesc.optimizeMeshes ? SCENE_CACHE_FLAG_OPTIMIZE_MESHES : 0;
+    header.flags |= loadSceneDesc.generateCompactVertices ? SCENE_CACHE_FLAG_COMPACT_VERTICES : 0;
+    header.flags |= loadSceneDesc.keepUnpackedVertices ? SCENE_CACHE_FLAG_UNPACKED_VERTICES : 0;
+    header.flags |= loadSceneDesc.generateVertexStreams ? SCENE_CACHE_FLAG_VERTEX_STREAMS : 0;
+    header.flags |= loadSceneDesc.sparseMorphTargets ? SCENE_CACHE_FLAG_SPARSE_MORPH_TARGETS : 0;
+    header.flags |= loadSceneDesc.compressAnimations ? SCENE_CACHE_FLAG_COMPRESSED_ANIMATIONS : 0;
+    header.lodNum = loadSceneDesc.lodNum;
+    header.meshletLimits = loadSceneDesc.meshletMaxVertexNum ? (loadSceneDesc.meshletMaxVertexNum | (loadSceneDesc.meshletMaxPrimitiveNum << 16)) : 0;
+
+    GetFileStamp(path, header.sourceSize, header.sourceTime);
+
+    return header;
+}
+
+static void WriteSceneNodes(SceneCacheWriter& writer, const std::vector<utils::SceneNode>& sceneNodes) {
+    writer.Write((uint32_t)sceneNodes.size());
+    for (const utils::SceneNode& node : sceneNodes) {
+        writer.WriteArray(node.instances);
+        writer.WriteString(node.name);
+        writer.Write(node.localTransform);
+        writer.Write(node.worldTransform);
+        writer.Write(node.rotation);
+        writer.Write(node.translation);
+        writer.Write(node.scale);
+        writer.Write(node.parentIndex);
+        writer.Write(node.descendantNum);
+    }
+}
+
+static void ReadSceneNodes(SceneCacheReader& reader, std::vector<utils::SceneNode>& sceneNodes) {
+    sceneNodes.resize(reader.ReadNum());
+    for (uint32_t i = 0; i < (uint32_t)sceneNodes.size(); i++) {
+        utils::SceneNode& node = sceneNodes[i];
+
+        reader.ReadArray(node.instances);
+        node.name = reader.ReadString();
+        node.localTransform = reader.Read<float4x4>();
+        node.worldTransform = reader.Read<float4x4>();
+        node.rotation = reader.Read<float4>();
+        node.translation = reader.Read<float3>();
+        node.scale = reader.Read<float3>();
+        node.parentIndex = reader.Read<uint32_t>();
+        node.descendantNum = reader.Read<uint32_t>();
+
+        // Parents precede children, subtrees stay within the array
+        if ((node.parentIndex != utils::InvalidIndex && node.parentIndex >= i) || node.descendantNum >= sceneNodes.size() - i)
+            reader.SetInvalid();
+    }
+}
+
+static void WriteTrackGroups(SceneCacheWriter& writer, const utils::Animation& animation) {
+    writer.Write((uint32_t)animation.trackGroups.size());
+    for (const utils::AnimationTrackGroup& group : animation.trackGroups) {
+        writer.Write(group.nodeIndices);
+        writer.Write(group.keyOffset);
+        writer.Write(group.keyNum);
+        writer.Write(group.valueOffset);
+        writer.Write(group.rangeOffset);
+        writer.Write(group.target);
+        writer.Write(group.type);
+        writer.Write(group.isQuantized);
+    }
+
+    writer.WriteArray(animation.keys);
+    writer.WriteArray(animation.values);
+    writer.WriteArray(animation.quantizedValues);
+}
+
+static void ReadTrackGroups(SceneCacheReader& reader, utils::Animation& animation, uint32_t sceneNodeNum) {
+    animation.trackGroups.resize(reader.ReadNum());
+    for (utils::AnimationTrackGroup& group : animation.trackGroups) {
+        for (uint32_t& nodeIndex : group.nodeIndices) {
+            nodeIndex = reader.Read<uint32_t>();
+            if (nodeIndex != utils::InvalidIndex && nodeIndex >= sceneNodeNum)
+                reader.SetInvalid();
+        }
+
+        group.keyOffset = reader.Read<uint32_t>();
+        group.keyNum = reader.Read<uint32_t>();
+        group.valueOffset = reader.Read<uint32_t>();
+        group.rangeOffset = reader.Read<uint32_t>();
+        group.target = reader.Read<utils::AnimationTrackTarget>();
+        group.type = reader.Read<utils::AnimationTrackType>();
+        group.isQuantized = reader.Read<bool>();
+    }
+
+    reader.ReadArray(animation.keys);
+    reader.ReadArray(animation.values);
+    reader.ReadArray(animation.quantizedValues);
+
+    // Groups must stay within the key and value storage
+    for (const utils::AnimationTrackGroup& group : animation.trackGroups) {
+        bool isRotation = group.target == utils::AnimationTrackTarget::ROTATION;
+        size_t valueNum = (size_t)group.keyNum * (group.isQuantized || !isRotation ? 12 : 16);
+        size_t valueStorageSize = group.isQuantized ? animation.quantizedValues.size() : animation.values.size();
+
+        bool isValid = group.keyNum && (size_t)group.keyOffset + group.keyNum <= animation.keys.size() && group.valueOffset + valueNum <= valueStorageSize;
+        if (group.isQuantized && !isRotation)
+            isValid = isValid && (size_t)group.rangeOffset + 24 <= animation.values.size();
+
+        if (!isValid)
+            reader.SetInvalid();
+    }
+}
+
+static void WriteAnimation(SceneCacheWriter& writer, const utils::Animation& animation) {
+    writer.WriteString(animation.name);
+    writer.Write(animation.durationMs);
+    writer.Write(animation.animationProgress);
+    writer.Write(animation.sign);
+    writer.Write(animation.animationTimeSec);
+
+    writer.WriteArray(animation.dynamicNodes);
+
+    WriteTrackGroups(writer, animation);
+
+    writer.Write((uint32_t)animation.weightTracks.size());
+    for (const utils::WeightsAnimationTrack& track : animation.weightTracks) {
+        writer.WriteArray(track.keys);
+
+        writer.Write((uint32_t)track.values.size());
+        for (const std::vector<utils::MorphTargetIndexWeight>& values : track.values)
+            writer.WriteArray(values);
+
+        writer.Write(track.frameCount);
+        writer.Write(track.type);
+    }
+
+    writer.WriteArray(animation.morphMeshInstances);
+}
+
+static void ReadAnimation(SceneCacheReader& reader, utils::Animation& animation, uint32_t sceneNodeNum) {
+    animation.name = reader.ReadString();
+    animation.durationMs = reader.Read<float>();
+    animation.animationProgress = reader.Read<float>();
+    animation.sign = reader.Read<float>();
+    animation.animationTimeSec = reader.Read<float>();
+
+    reader.ReadArray(animation.dynamicNodes);
+    for (uint32_t nodeIndex : animation.dynamicNodes) {
+        if (nodeIndex >= sceneNodeNum)
+            reader.SetInvalid();
+    }
+
+    ReadTrackGroups(reader, animation, sceneNodeNum);
+
+    animation.weightTracks.resize(reader.ReadNum());
+    for (utils::WeightsAnimationTrack& track : animation.weightTracks) {
+        reader.ReadArray(track.keys);
+
+        track.values.resize(reader.ReadNum());
+        for (std::vector<utils::MorphTargetIndexWeight>& values : track.values)
+            reader.ReadArray(values);
+
+        track.frameCount = reader.Read<uint32_t>();
+        track.type = reader.Read<utils::AnimationTrackType>();
+    }
+
+    reader.ReadArray(animation.morphMeshInstances);
+}
+
+// Only the source is hashed, i.e. offsets read from the cache must be checked against the arrays they point into
+static bool IsSceneCacheGeometryValid(const utils::Scene& scene) {
+    for (const utils::Mesh& mesh : scene.meshes) {
+        size_t indexStorageNum = mesh.indexType == nri::IndexType::UINT16 ? scene.indices16.size() : scene.indices.size();
+
+        bool isValid = (size_t)mesh.vertexOffset + mesh.vertexNum <= scene.vertices.size();
+        isValid = isValid && (size_t)mesh.indexOffset + mesh.indexNum <= indexStorageNum;
+        isValid = isValid && (size_t)mesh.primitiveOffset + mesh.indexNum / 3 <= scene.primitives.size();
+        isValid = isValid && (size_t)mesh.meshletOffset + mesh.meshletNum <= scene.meshlets.size();
+        isValid = isValid && (size_t)mesh.lodOffset + mesh.lodNum <= scene.meshLods.size();
+
+        if (mesh.streamVertexOffset != utils::InvalidIndex)
+            isValid = isValid && (size_t)mesh.streamVertexOffset + mesh.vertexNum <= min(scene.vertexPositions.size(), scene.vertexAttributes.size());
+
+        if (mesh.HasMorphTargets()) {
+            isValid = isValid && (size_t)mesh.morphTargetVertexOffset + (size_t)mesh.vertexNum * GetMorphBlockNum(mesh) <= scene.morphVertices.size();
+            if (mesh.morphTargetOffset != utils::InvalidIndex)
+                isValid = isValid && (size_t)mesh.morphTargetOffset + mesh.morphTargetNum <= scene.morphTargets.size();
+        }
+
+        if (!isValid)
+            return false;
+
+        for (uint32_t i = 0; i < mesh.lodNum; i++) {
+            const utils::MeshLod& lod = scene.meshLods[mesh.lodOffset + i];
+            if ((size_t)lod.indexOffset + lod.indexNum > indexStorageNum)
+                return false;
+        }
+    }
+
+    for (const utils::Meshlet& meshlet : scene.meshlets) {
+        if ((size_t)meshlet.vertexOffset + meshlet.vertexNum > scene.meshletVertices.size() || (size_t)meshlet.primitiveOffset + meshlet.primitiveNum * 3 > scene.meshletPrimitives.size())
+            return false;
+    }
+
+    for (const utils::MorphTarget& morphTarget : scene.morphTargets) {
+        if ((size_t)morphTarget.deltaOffset + morphTarget.deltaNum > scene.morphDeltas.size())
+            return false;
+    }
+
+    for (const utils::MeshInstance& meshInstance : scene.meshInstances) {
+        if (meshInstance.meshIndex >= scene.meshes.size())
+            return false;
+    }
+
+    for (uint32_t meshIndex : scene.morphMeshes) {
+        if (meshIndex >= scene.meshes.size())
+            return false;
+    }
+
+    for (const utils::Instance& instance : scene.instances) {
+        if (instance.meshInstanceIndex >= scene.meshInstances.size())
+            return false;
+    }
+
+    return true;
+}
+
+static void SaveSceneCache(const std::string& cachePath, const std::filesystem::path& folder, const SceneCacheHeader& header, const std::vector<std::string>& dependencies,
+    const utils::Scene& scene, const std::vector<SceneTextureRequest>& textureRequests, const std::vector<SceneMaterialTextures>& materialTextures) {
+    // Write into a temporary file first, a partially written cache must never be picked up
+    std::string tempPath = cachePath + ".tmp";
+
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        printf("WARNING: Can't write scene cache '%s'!\n", cachePath.c_str());
+        return;
+    }
+
+    SceneCacheWriter writer(file);
+    writer.Write(header);
+
+    { // Dependencies (size and time stamps)
+        std::vector<std::string> paths = dependencies;
+        for (const SceneTextureRequest& request : textureRequests) {
+            if (!request.data) {
+                paths.push_back(request.path);
+                paths.push_back(request.path.substr(0, request.path.find_last_of('.')) + ".dds");
+            }
+        }
+
+        writer.Write((uint32_t)paths.size());
+        for (const std::string& path : paths) {
+            uint64_t size = 0;
+            int64_t time = 0;
+            GetFileStamp(path, size, time);
+
+            writer.WriteString(GetRelativePath(path, folder));
+            writer.Write(size);
+            writer.Write(time);
+        }
+    }
+
+    // Geometry
+    writer.WriteArray(scene.vertices);
+    writer.WriteArray(scene.compactVertices);
+    writer.WriteArray(scene.vertexPositions);
+    writer.WriteArray(scene.vertexAttributes);
+    writer.WriteArray(scene.unpackedVertices);
+    writer.WriteArray(scene.indices);
+    writer.WriteArray(scene.indices16);
+    writer.WriteArray(scene.primitives);
+    writer.WriteArray(scene.morphVertices);
+    writer.WriteArray(scene.morphTargets);
+    writer.WriteArray(scene.morphDeltas);
+    writer.WriteArray(scene.meshLods);
+    writer.WriteArray(scene.meshlets);
+    writer.WriteArray(scene.meshletVertices);
+    writer.WriteArray(scene.meshletPrimitives);
+
+    // Materials (texture indices are resolved on load) and instances
+    writer.WriteArray(scene.materials);
+    writer.WriteArray(scene.instances);
+    writer.WriteArray(scene.meshes);
+    writer.WriteArray(scene.meshInstances);
+    writer.WriteArray(scene.morphMeshes);
+    writer.Write(scene.mSceneToWorld);
+    writer.Write(scene.aabb);
+    writer.Write(scene.totalInstancedPrimitivesNum);
+    writer.Write(scene.morphIndexNum);
+    writer.Write(scene.morphVertexNum);
+    writer.Write(scene.morphPrimitiveNum);
+
+    // Textures (embedded images are stored as is)
+    writer.Write((uint32_t)textureRequests.size());
+    for (const SceneTextureRequest& request : textureRequests) {
+        writer.Write((uint8_t)(request.data ? 1 : 0));
+        writer.Write((uint8_t)request.computeAlphaMode);
+        writer.Write((uint8_t)request.makeSRGB);
+
+        if (request.data) {
+            writer.WriteString(request.path);
+            writer.Write((uint64_t)request.dataSize);
+            writer.Align();
+            writer.WriteBytes(request.data, request.dataSize);
+        } else
+            writer.WriteString(GetRelativePath(request.path, folder));
+    }
+
+    writer.WriteArray(materialTextures);
+
+    // Animations
+    WriteSceneNodes(writer, scene.sceneNodes);
+
+    writer.Write((uint32_t)scene.animations.size());
+    for (const utils::Animation& animation : scene.animations)
+        WriteAnimation(writer, animation);
+
+    writer.Write(SCENE_CACHE_MAGIC);
+
+    bool isWritten = writer.IsValid();
+    isWritten = fclose(file) == 0 && isWritten;
+
+    std::error_code ec;
+    if (isWritten)
+        std::filesystem::rename(tempPath, cachePath, ec);
+
+    if (!isWritten || ec) {
+        std::filesystem::remove(tempPath, ec);
+        printf("WARNING: Can't write scene cache '%s'!\n", cachePath.c_str());
+    }
+}
+
+static bool LoadSceneCache(utils::SceneLoadingContext& context, const std::string& cachePath, const std::filesystem::path& folder, const SceneCacheHeader& expectedHeader) {
+    std::error_code ec;
+    if (!std::filesystem::exists(cachePath, ec))
+        return false;
+
+    // Embedded images reference the mapping
+    utils::FileView& file = context.cacheFile;
+    if (!file.Open(cachePath))
+        return false;
+
+    utils::Scene& scene = *context.scene;
+
+    SceneCacheReader reader(file.GetData(), file.GetSize());
+
+    // The source is hashed only if its size and time stamp match
+    SceneCacheHeader header = reader.Read<SceneCacheHeader>();
+    SceneCacheHeader expected = expectedHeader;
+    expected.sourceHash = header.sourceHash;
+
+    bool isUpToDate = reader.IsValid() && memcmp(&header, &expected, sizeof(header)) == 0;
+    if (isUpToDate) {
+        const utils::FileView& source = context.files[0];
+        isUpToDate = header.sourceHash == HashBytes(source.GetData(), source.GetSize());
+    }
+
+    if (!isUpToDate) {
+        printf("Scene cache '%s' is outdated\n", utils::GetFileName(cachePath));
+        return false;
+    }
+
+    uint32_t dependencyNum = reader.ReadNum();
+    for (uint32_t i = 0; i < dependencyNum; i++) {
+        std::string path = reader.ReadString();
+        uint64_t size = reader.Read<uint64_t>();
+        int64_t time = reader.Read<int64_t>();
+
+        uint64_t currentSize = 0;
+        int64_t currentTime = 0;
+        GetFileStamp(folder / path, currentSize, currentTime);
+
+        if (!reader.IsValid() || size != currentSize || time != currentTime) {
+            printf("Scene cache '%s' is outdated\n", utils::GetFileName(cachePath));
+            return false;
         }
     }
-}
-} // namespace utils
-
-bool utils::LoadTextureFromMemory(const std::string& name, const uint8_t* data, int dataSize,
-    Texture& texture, bool computeAvgColorAndAlphaMode) {
-    printf("Loading embedded texture '%s'...\n", name.c_str());
 
-    int x, y, comp;
-    unsigned char* image = stbi_load_from_memory((stbi_uc const*)data, dataSize, &x, &y, &comp, STBI_rgb_alpha);
-    if (!image) {
-        printf("Could not read memory for embedded texture %s. Reason: %s", name.c_str(), stbi_failure_reason());
-        return false;
+    // Geometry
+    reader.ReadArray(scene.vertices);
+    reader.ReadArray(scene.compactVertices);
+    reader.ReadArray(scene.vertexPositions);
+    reader.ReadArray(scene.vertexAttributes);
+    reader.ReadArray(scene.unpackedVertices);
+    reader.ReadArray(scene.indices);
+    reader.ReadArray(scene.indices16);
+    reader.ReadArray(scene.primitives);
+    reader.ReadArray(scene.morphVertices);
+    reader.ReadArray(scene.morphTargets);
+    reader.ReadArray(scene.morphDeltas);
+    reader.ReadArray(scene.meshLods);
+    reader.ReadArray(scene.meshlets);
+    reader.ReadArray(scene.meshletVertices);
+    reader.ReadArray(scene.meshletPrimitives);
+
+    // Materials and instances
+    reader.ReadArray(scene.materials);
+    reader.ReadArray(scene.instances);
+    reader.ReadArray(scene.meshes);
+    reader.ReadArray(scene.meshInstances);
+    reader.ReadArray(scene.morphMeshes);
+    scene.mSceneToWorld = reader.Read<float4x4>();
+    scene.aabb = reader.Read<cBoxf>();
+    scene.totalInstancedPrimitivesNum = reader.Read<uint32_t>();
+    scene.morphIndexNum = reader.Read<uint32_t>();
+    scene.morphVertexNum = reader.Read<uint32_t>();
+    scene.morphPrimitiveNum = reader.Read<uint32_t>();
+
+    // Textures
+    std::vector<SceneTextureRequest>& textureRequests = context.textureRequests;
+    textureRequests.resize(reader.ReadNum());
+    for (SceneTextureRequest& request : textureRequests) {
+        bool isEmbedded = reader.Read<uint8_t>() != 0;
+        request.computeAlphaMode = reader.Read<uint8_t>() != 0;
+        request.makeSRGB = reader.Read<uint8_t>() != 0;
+
+        if (isEmbedded) {
+            request.path = reader.ReadString();
+            request.dataSize = (size_t)reader.Read<uint64_t>();
+            reader.Align();
+            request.data = reader.ReadBytes(request.dataSize);
+        } else
+            request.path = (folder / reader.ReadString()).string();
     }
-    detexTexture** dTexture = (detexTexture**)malloc(sizeof(detexTexture*));
-    dTexture[0] = (detexTexture*)malloc(sizeof(detexTexture));
-    dTexture[0]->format = DETEX_PIXEL_FORMAT_RGBA8;
-    dTexture[0]->width = x;
-    dTexture[0]->height = y;
-    dTexture[0]->width_in_blocks = x;
-    dTexture[0]->height_in_blocks = y;
-    size_t size = x * y * detexGetPixelSize(DETEX_PIXEL_FORMAT_RGBA8);
-    dTexture[0]->data = (uint8_t*)malloc(size);
-    memcpy(dTexture[0]->data, image, size);
-    stbi_image_free(image);
 
-    const int kMipNum = 1;
-    PostProcessTexture(name, texture, computeAvgColorAndAlphaMode, dTexture, kMipNum);
-    return true;
-}
+    std::vector<SceneMaterialTextures>& materialTextures = context.materialTextures;
+    reader.ReadArray(materialTextures);
 
-bool utils::LoadTexture(const std::string& path, Texture& texture, bool computeAvgColorAndAlphaMode) {
-    printf("Loading texture '%s'...\n", GetFileName(path));
+    // Animations
+    ReadSceneNodes(reader, scene.sceneNodes);
 
-    detexTexture** dTexture = nullptr;
-    int mipNum = 0;
+    scene.animations.resize(reader.ReadNum());
+    for (utils::Animation& animation : scene.animations)
+        ReadAnimation(reader, animation, (uint32_t)scene.sceneNodes.size());
 
-    if (!detexLoadTextureFileWithMipmaps(path.c_str(), 32, &dTexture, &mipNum)) {
-        printf("ERROR: Can't load texture '%s'\n", path.c_str());
+    bool isValid = reader.Read<uint32_t>() == SCENE_CACHE_MAGIC && reader.IsValid() && IsSceneCacheGeometryValid(scene);
+    for (const SceneMaterialTextures& textures : materialTextures) {
+        for (uint32_t requestIndex : textures.requestIndices)
+            isValid = isValid && (requestIndex == utils::InvalidIndex || requestIndex < textureRequests.size());
+    }
+
+    if (!isValid || materialTextures.size() != scene.materials.size()) {
+        printf("WARNING: Scene cache '%s' is corrupted!\n", cachePath.c_str());
+
+        std::vector<utils::Texture*> textures = std::move(scene.textures);
+        scene = utils::Scene();
+        scene.textures = std::move(textures);
+
+        textureRequests.clear();
+        materialTextures.clear();
+        file.Close();
 
         return false;
     }
 
-    PostProcessTexture(path, texture, computeAvgColorAndAlphaMode, dTexture, mipNum);
+    context.CompleteStage(utils::SceneLoadingStage::PARSE);
+    context.CompleteStage(utils::SceneLoadingStage::GEOMETRY);
+    context.CompleteStage(utils::SceneLoadingStage::TANGENTS);
+    context.CompleteStage(utils::SceneLoadingStage::ANIMATIONS);
+
+    if (scene.textures.empty())
+        LoadStaticTextures(scene);
+
+    std::vector<uint32_t> pendingTextureIndices(textureRequests.size(), utils::InvalidIndex);
+    ResolveSceneMaterials(context, pendingTextureIndices);
 
     return true;
 }
 
-void utils::LoadTextureFromMemory(nri::Format format, uint32_t width, uint32_t height, const uint8_t* pixels, Texture& texture) {
-    assert(format == nri::Format::R8_UNORM);
+//========================================================================================================================
+// SCENE
+//========================================================================================================================
 
-    detexTexture** dTexture;
-    detexLoadTextureFromMemory(DETEX_PIXEL_FORMAT_R8, width, height, pixels, &dTexture);
+struct AnimationChannel {
+    std::vector<float> keys;
+    std::vector<float> values; // 3 or 4 floats per key
+    uint32_t nodeIndex;
+    utils::AnimationTrackTarget target;
+    utils::AnimationTrackType type;
+};
 
-    texture.mipNum = 1;
-    texture.layerNum = 1;
-    texture.depth = 1;
-    texture.format = format;
-    texture.alphaMode = AlphaMode::OPAQUE;
-    texture.mips = (Mip*)dTexture;
+static inline bool HasSameTimeline(const AnimationChannel& a, const AnimationChannel& b) {
+    return a.target == b.target && a.type == b.type && a.keys == b.keys;
 }
 
-static const char* cgltfErrorToString(cgltf_result res) {
-    switch (res) {
-        case cgltf_result_success:
-            return "Success";
-        case cgltf_result_data_too_short:
-            return "Data is too short";
-        case cgltf_result_unknown_format:
-            return "Unknown format";
-        case cgltf_result_invalid_json:
-            return "Invalid JSON";
-        case cgltf_result_invalid_gltf:
-            return "Invalid GLTF";
-        case cgltf_result_invalid_options:
-            return "Invalid options";
-        case cgltf_result_file_not_found:
-            return "File not found";
-        case cgltf_result_io_error:
-            return "I/O error";
-        case cgltf_result_out_of_memory:
-            return "Out of memory";
-        case cgltf_result_legacy_gltf:
-            return "Legacy GLTF";
-        default:
-            return "Unknown error";
-    }
+constexpr float ANIMATION_KEY_TOLERANCE = 1e-4f; // max deviation of a removed key (absolute, quaternion components for rotations)
+constexpr uint32_t ANIMATION_KEY_MAX_GAP = 256;  // max keys between kept keys, bounds the cost of error checks
+constexpr float SQRT_HALF = 0.70710678f;         // the range of "smallest three" components is [-SQRT_HALF; SQRT_HALF]
+
+static inline float4 GetLaneValue(const float* values, uint32_t componentNum, uint32_t key, uint32_t lane) {
+    const float* src = values + key * componentNum * 4 + lane;
+
+    return float4(src[0], src[4], src[8], componentNum == 4 ? src[12] : 0.0f);
 }
 
-static std::pair<const uint8_t*, size_t> cgltfBufferIterator(const cgltf_accessor* accessor, size_t defaultStride) {
-    if (!accessor)
-        return std::make_pair(nullptr, 0);
+// Can keys in (from; to) be reproduced (in all lanes) by the runtime interpolation of "from" and "to"?
+static bool IsKeySpanReducible(const float* keys, const float* values, uint32_t from, uint32_t to, uint32_t componentNum, utils::AnimationTrackType type) {
+    bool isRotation = componentNum == 4;
 
-    // TODO: sparse accessor support
-    const cgltf_buffer_view* view = accessor->buffer_view;
-    const uint8_t* data = (uint8_t*)view->buffer->data + view->offset + accessor->offset;
-    const size_t stride = view->stride ? view->stride : defaultStride;
+    for (uint32_t lane = 0; lane < 4; lane++) {
+        float4 a = GetLaneValue(values, componentNum, from, lane);
+        float4 b = GetLaneValue(values, componentNum, to, lane);
 
-    return std::make_pair(data, stride);
-}
+        if (isRotation && dot(a, b) < 0.0f)
+            a = -a;
 
-// GLTF only support DDS images through the MSFT_texture_dds extension.
-// Since cgltf does not support this extension, we parse the custom extension string as json here.
-// See https://github.com/KhronosGroup/GLTF/tree/master/extensions/2.0/Vendor/MSFT_texture_dds
-static const cgltf_image* ParseDdsImage(const cgltf_texture* texture, const cgltf_data* objects) {
-    for (size_t i = 0; i < texture->extensions_count; i++) {
-        const cgltf_extension& ext = texture->extensions[i];
+        for (uint32_t k = from + 1; k < to; k++) {
+            float4 value = GetLaneValue(values, componentNum, k, lane);
 
-        if (!ext.name || !ext.data)
-            continue;
+            float4 expected = a;
+            if (type != utils::AnimationTrackType::Step) {
+                float t = (keys[k] - keys[from]) / (keys[to] - keys[from]);
+                expected = isRotation ? Slerp(a, b, t) : (a + (b - a) * t);
+            }
 
-        if (strcmp(ext.name, "MSFT_texture_dds") != 0)
-            continue;
+            float4 error = abs(value - expected);
+            float maxError = max(max(error.x, error.y), max(error.z, error.w));
 
-        size_t extensionLength = strlen(ext.data);
-        if (extensionLength > 1024)
-            return nullptr; // safeguard against weird inputs
+            // "q" and "-q" are the same rotation
+            if (isRotation) {
+                error = abs(value + expected);
+                maxError = min(maxError, max(max(error.x, error.y), max(error.z, error.w)));
+            }
 
-        jsmn_parser parser;
-        jsmn_init(&parser);
+            if (maxError > ANIMATION_KEY_TOLERANCE)
+                return false;
+        }
+    }
 
-        // count the tokens, normally there are 3
-        int numTokens = jsmn_parse(&parser, ext.data, extensionLength, nullptr, 0);
+    return true;
+}
 
-        // allocate the tokens on the stack
-        jsmntok_t* tokens = (jsmntok_t*)alloca(numTokens * sizeof(jsmntok_t));
+// Greedy: a key is removed if the span from the last kept key to the next key stays within the tolerance. Returns the new key number
+static uint32_t ReduceKeys(std::vector<float>& keys, std::vector<float>& values, uint32_t componentNum, utils::AnimationTrackType type) {
+    uint32_t keyNum = (uint32_t)keys.size();
+    if (keyNum <= 2)
+        return keyNum;
+
+    std::vector<uint32_t> keptKeys = {0};
+    for (uint32_t k = 1; k + 1 < keyNum; k++) {
+        uint32_t last = keptKeys.back();
+        if (k + 1 - last > ANIMATION_KEY_MAX_GAP || !IsKeySpanReducible(keys.data(), values.data(), last, k + 1, componentNum, type))
+            keptKeys.push_back(k);
+    }
+    keptKeys.push_back(keyNum - 1);
 
-        // reset the parser and prse
-        jsmn_init(&parser);
-        int numParsed = jsmn_parse(&parser, ext.data, extensionLength, tokens, numTokens);
-        if (numParsed != numTokens)
-            goto fail;
+    uint32_t keyStride = componentNum * 4;
+    for (uint32_t i = 0; i < (uint32_t)keptKeys.size(); i++) {
+        keys[i] = keys[keptKeys[i]];
+        memmove(&values[i * keyStride], &values[keptKeys[i] * keyStride], keyStride * sizeof(float));
+    }
 
-        if (tokens[0].type != JSMN_OBJECT)
-            goto fail; // expecting that the extension is an object
+    return (uint32_t)keptKeys.size();
+}
 
-        for (int k = 1; k < numTokens; k++) {
-            if (tokens[k].type != JSMN_STRING)
-                goto fail; // expecting a string key
+static inline uint16_t QuantizeUnorm(float x, float maxValue) {
+    return (uint16_t)(clamp(x, 0.0f, 1.0f) * maxValue + 0.5f);
+}
 
-            if (cgltf_json_strcmp(tokens + k, (const uint8_t*)ext.data, "source") == 0) {
-                ++k;
-                int index = cgltf_json_to_int(tokens + k, (const uint8_t*)ext.data);
-                if (index < 0)
-                    goto fail; // expecting a non-negative integer; non-value results in CGLTF_ERROR_JSON which is negative
+static void QuantizeTrackGroup(utils::Animation& animation, utils::AnimationTrackGroup& group, const float* soaValues) {
+    group.isQuantized = true;
+    group.valueOffset = (uint32_t)animation.quantizedValues.size();
+
+    animation.quantizedValues.resize(animation.quantizedValues.size() + group.keyNum * 12);
+    uint16_t* dst = animation.quantizedValues.data() + group.valueOffset;
+
+    if (group.target == utils::AnimationTrackTarget::ROTATION) {
+        for (uint32_t k = 0; k < group.keyNum; k++) {
+            for (uint32_t lane = 0; lane < 4; lane++) {
+                float q[4];
+                for (uint32_t c = 0; c < 4; c++)
+                    q[c] = soaValues[k * 16 + c * 4 + lane];
+
+                float len = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+                uint32_t omitted = 0;
+                for (uint32_t c = 1; c < 4; c++) {
+                    if (fabsf(q[c]) > fabsf(q[omitted]))
+                        omitted = c;
+                }
 
-                if (size_t(index) >= objects->images_count) {
-                    printf("WARNING: Invalid image index %d specified in GLTF texture definition\n", index);
-                    return nullptr;
+                // The omitted component is restored as positive
+                float invLen = (q[omitted] < 0.0f ? -1.0f : 1.0f) / max(len, 1e-15f);
+
+                float rest[3];
+                for (uint32_t c = 0, j = 0; c < 4; c++) {
+                    if (c != omitted)
+                        rest[j++] = q[c] * invLen * (0.5f / SQRT_HALF) + 0.5f;
                 }
 
-                return objects->images + index;
+                uint16_t* p = dst + k * 12 + lane;
+                p[0] = (uint16_t)((QuantizeUnorm(rest[0], 32767.0f) << 1) | (omitted & 0x1));
+                p[4] = (uint16_t)((QuantizeUnorm(rest[1], 32767.0f) << 1) | (omitted >> 1));
+                p[8] = QuantizeUnorm(rest[2], 65535.0f);
             }
-
-            // this was something else - skip it
-            k = cgltf_skip_json(tokens, k);
         }
+    } else {
+        group.rangeOffset = (uint32_t)animation.values.size();
+
+        animation.values.resize(animation.values.size() + 24);
+        float* range = animation.values.data() + group.rangeOffset;
+
+        for (uint32_t c = 0; c < 3; c++) {
+            for (uint32_t lane = 0; lane < 4; lane++) {
+                float minValue = soaValues[c * 4 + lane];
+                float maxValue = minValue;
+                for (uint32_t k = 1; k < group.keyNum; k++) {
+                    float value = soaValues[k * 12 + c * 4 + lane];
+                    minValue = min(minValue, value);
+                    maxValue = max(maxValue, value);
+                }
 
-    fail:
-        printf("WARNING: Failed to parse the DDS GLTF extension: %s\n", ext.data);
-        return nullptr;
-    }
+                float extent = maxValue - minValue;
+                range[c * 4 + lane] = minValue;
+                range[12 + c * 4 + lane] = extent / 65535.0f;
 
-    return nullptr;
+                float invExtent = extent > 0.0f ? 1.0f / extent : 0.0f;
+                for (uint32_t k = 0; k < group.keyNum; k++)
+                    dst[k * 12 + c * 4 + lane] = QuantizeUnorm((soaValues[k * 12 + c * 4 + lane] - minValue) * invExtent, 65535.0f);
+            }
+        }
+    }
 }
 
-static void DecomposeAffine(const float4x4& transform, float3& translation, float4& rotation, float3& scale) {
-    translation = transform.Col(3).xyz;
-
-    float3 col0 = transform.Col(0).xyz;
-    float3 col1 = transform.Col(1).xyz;
-    float3 col2 = transform.Col(2).xyz;
+// Channels sharing keys, target and interpolation are packed into groups of 4, unused lanes replicate the first one
+static void CompileAnimationTracks(utils::Animation& animation, const std::vector<AnimationChannel>& channels, bool compress) {
+    std::vector<uint32_t> order(channels.size());
+    for (uint32_t i = 0; i < (uint32_t)order.size(); i++)
+        order[i] = i;
+
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        const AnimationChannel& ca = channels[a];
+        const AnimationChannel& cb = channels[b];
+
+        if (ca.target != cb.target)
+            return ca.target < cb.target;
+        if (ca.type != cb.type)
+            return ca.type < cb.type;
+        if (ca.keys != cb.keys)
+            return ca.keys < cb.keys;
+
+        return a < b;
+    });
+
+    for (size_t i = 0; i < order.size();) {
+        const AnimationChannel& first = channels[order[i]];
+
+        uint32_t laneNum = 1;
+        while (laneNum < 4 && i + laneNum < order.size() && HasSameTimeline(first, channels[order[i + laneNum]]))
+            laneNum++;
+
+        uint32_t keyNum = (uint32_t)first.keys.size();
+        uint32_t componentNum = first.target == utils::AnimationTrackTarget::ROTATION ? 4 : 3;
+
+        std::vector<float> keys = first.keys;
+        std::vector<float> values(keyNum * componentNum * 4);
+        for (uint32_t k = 0; k < keyNum; k++) {
+            for (uint32_t c = 0; c < componentNum; c++) {
+                for (uint32_t lane = 0; lane < 4; lane++) {
+                    const AnimationChannel& channel = channels[order[i + min(lane, laneNum - 1)]];
+                    values[(k * componentNum + c) * 4 + lane] = channel.values[k * componentNum + c];
+                }
+            }
+        }
 
-    scale.x = length(col0);
-    scale.y = length(col1);
-    scale.z = length(col2);
-    if (scale.x > 0.f)
-        col0 /= scale.x;
-    if (scale.y > 0.f)
-        col1 /= scale.y;
-    if (scale.z > 0.f)
-        col2 /= scale.z;
+        // "CubicSpline" groups are quantized, but not key-reduced, because they are evaluated as "Linear"
+        if (compress && first.type != utils::AnimationTrackType::CubicSpline)
+            keyNum = ReduceKeys(keys, values, componentNum, first.type);
 
-    float3 zAxis = cross(col0, col1);
-    if (dot(zAxis, col2) < 0.0f) {
-        scale.x = -scale.x;
-        col0 = -col0;
-    }
+        utils::AnimationTrackGroup& group = animation.trackGroups.emplace_back();
+        group.keyOffset = (uint32_t)animation.keys.size();
+        group.keyNum = keyNum;
+        group.valueOffset = (uint32_t)animation.values.size();
+        group.target = first.target;
+        group.type = first.type;
 
-    // https://www.euclideanspace.com/maths/geometry/rotations/conversions/matrixToQuaternion/
-    rotation.w = sqrt(max(0.0f, 1.0f + col0.x + col1.y + col2.z)) * 0.5f;
-    rotation.x = sqrt(max(0.0f, 1.0f + col0.x - col1.y - col2.z)) * 0.5f;
-    rotation.y = sqrt(max(0.0f, 1.0f - col0.x + col1.y - col2.z)) * 0.5f;
-    rotation.z = sqrt(max(0.0f, 1.0f - col0.x - col1.y + col2.z)) * 0.5f;
-    rotation.x = std::copysign(rotation.x, col2.y - col1.z);
-    rotation.y = std::copysign(rotation.y, col0.z - col2.x);
-    rotation.z = std::copysign(rotation.z, col1.x - col0.y);
-}
+        for (uint32_t lane = 0; lane < laneNum; lane++)
+            group.nodeIndices[lane] = channels[order[i + lane]].nodeIndex;
 
-static inline bool IsGltfPrimitiveSupported(const cgltf_primitive& primitive) {
-    return (primitive.type == cgltf_primitive_type_triangles || primitive.type == cgltf_primitive_type_lines) && primitive.attributes_count > 0;
-}
+        animation.keys.insert(animation.keys.end(), keys.begin(), keys.begin() + keyNum);
 
-static inline void GetBasis(float3 N, float3& T, float3& B) {
-    float sz = sign(N.z);
-    float a = 1.0f / (sz + N.z);
-    float ya = N.y * a;
-    float b = N.x * ya;
-    float c = N.x * sz;
+        if (compress)
+            QuantizeTrackGroup(animation, group, values.data());
+        else
+            animation.values.insert(animation.values.end(), values.begin(), values.begin() + keyNum * componentNum * 4);
 
-    T = float3(c * N.x * a - 1.0f, sz * b, c);
-    B = float3(b, N.y * ya - sz, N.y);
+        i += laneNum;
+    }
 }
 
-static inline void SetVertex(utils::Scene& scene, uint32_t i, const float3& p, const float2& uv, const float3& N, const float3& T) {
-    utils::UnpackedVertex& v = scene.unpackedVertices[i];
-    v.pos[0] = p.x;
-    v.pos[1] = p.y;
-    v.pos[2] = p.z;
-    v.uv[0] = uv.x;
-    v.uv[1] = uv.y;
-    v.N[0] = N.x;
-    v.N[1] = N.y;
-    v.N[2] = N.z;
-    v.T[0] = T.x;
-    v.T[1] = T.y;
-    v.T[2] = T.z;
-
-    utils::Vertex& vp = scene.vertices[i];
-    vp.pos[0] = p.x;
-    vp.pos[1] = p.y;
-    vp.pos[2] = p.z;
-    vp.uv = float2(uv);
-    vp.N = Packing::float4_to_unorm<10, 10, 10, 2>(float4(N * 0.5f + 0.5f, 0.0f));
-    vp.T = Packing::float4_to_unorm<10, 10, 10, 2>(float4(T * 0.5f + 0.5f, 0.0f));
-}
+namespace utils {
+static bool LoadSceneGeometry(SceneLoadingContext& context) {
+    const std::string& path = context.path;
+    const LoadSceneDesc& loadSceneDesc = context.desc;
+    Scene& scene = *context.scene;
 
-bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
     printf("Loading scene '%s'...\n", GetFileName(path));
 
     std::filesystem::path normPath(path.c_str());
     normPath = std::filesystem::canonical(normPath);
 
+    // The scene file and external buffers are mapped, "cgltf" references them instead of making copies
+    std::vector<FileView>& files = context.files;
+    files.resize(1);
+    if (!files[0].Open(path))
+        return false;
+
+    // Indices in the cache are absolute, i.e. it's usable only if the scene is loaded into an empty "Scene"
+    bool useCache = loadSceneDesc.useCache && scene.meshes.empty() && scene.materials.empty() && scene.instances.empty() && scene.animations.empty() && scene.sceneNodes.empty();
+    std::string cachePath = path + ".cache";
+    std::vector<std::string> dependencies;
+
+    SceneCacheHeader cacheHeader = {};
+    if (useCache) {
+        cacheHeader = GetSceneCacheHeader(normPath, loadSceneDesc);
+        if (LoadSceneCache(context, cachePath, normPath.parent_path(), cacheHeader))
+            return true;
+    }
+
     cgltf_options options{};
 
-    cgltf_data* objects{};
-    cgltf_result res = cgltf_parse_file(&options, path.c_str(), &objects);
+    cgltf_data*& objects = context.objects;
+    cgltf_result res = cgltf_parse(&options, files[0].GetData(), files[0].GetSize(), &objects);
     if (res != cgltf_result_success) {
         printf("Couldn't load GLTF file '%s': %s", path.c_str(), cgltfErrorToString(res));
         return false;
     }
 
+    for (cgltf_size i = 0; i < objects->buffers_count; i++) {
+        cgltf_buffer& buffer = objects->buffers[i];
+        if (buffer.data || !buffer.uri || strncmp(buffer.uri, "data:", 5) == 0)
+            continue; // "cgltf_load_buffers" handles GLB and base64 buffers
+
+        std::string uri = buffer.uri;
+        uri.resize(cgltf_decode_uri(&uri[0]));
+
+        std::string bufferPath = (normPath.parent_path() / uri).string();
+        dependencies.push_back(bufferPath);
+
+        FileView& file = files.emplace_back();
+        if (!file.Open(bufferPath) || file.GetSize() < buffer.size) {
+            printf("Failed to load buffers for GLTF file '%s': %s", path.c_str(), cgltfErrorToString(cgltf_result_io_error));
+            return false;
+        }
+
+        buffer.data = (void*)file.GetData();
+        buffer.data_free_method = cgltf_data_free_method_none;
+    }
+
     res = cgltf_load_buffers(&options, objects, path.c_str());
     if (res != cgltf_result_success) {
         printf("Failed to load buffers for GLTF file '%s': %s", path.c_str(), cgltfErrorToString(res));
         return false;
     }
 
+    context.CompleteStage(SceneLoadingStage::PARSE);
+
     // Meshes
     // TODO: framework doesn't support multiple submeshes per instance, treat every primitive as a separate mesh
     std::vector<std::vector<size_t>> meshesPrimMap;
@@ -810,35 +3673,25 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
             Mesh& mesh = scene.meshes[meshIndex];
             mesh.indexOffset = (uint32_t)totalIndexNum;
             mesh.vertexOffset = (uint32_t)totalVertexNum;
+            mesh.primitiveOffset = (uint32_t)(totalIndexNum / 3);
             mesh.indexNum = (uint32_t)indexNum;
             mesh.vertexNum = (uint32_t)vertexNum;
 
             totalIndexNum += mesh.indexNum;
             totalVertexNum += mesh.vertexNum;
 
-            // Morph targets
+            // Morph targets (missing positions or normals mean zero deltas)
             bool hasMorphTargets = gltfSubmesh.targets_count > 0;
-            for (uint32_t target_idx = 0; target_idx < gltfSubmesh.targets_count; target_idx++) {
+            for (uint32_t target_idx = 0; target_idx < gltfSubmesh.targets_count && hasMorphTargets; target_idx++) {
                 const cgltf_morph_target& morphTarget = gltfSubmesh.targets[target_idx];
-                if (morphTarget.attributes_count == 0) {
-                    hasMorphTargets = false;
-                    break;
-                }
 
-                bool hasPositions = false;
-                bool hasNormals = false;
                 for (uint32_t attr_idx = 0; attr_idx < morphTarget.attributes_count; attr_idx++) {
-                    if (morphTarget.attributes[attr_idx].type == cgltf_attribute_type_position) {
-                        hasPositions = morphTarget.attributes[attr_idx].data->count == mesh.vertexNum;
-                    } else if (morphTarget.attributes[attr_idx].type == cgltf_attribute_type_normal) {
-                        hasNormals = morphTarget.attributes[attr_idx].data->count == mesh.vertexNum;
+                    const cgltf_attribute& attr = morphTarget.attributes[attr_idx];
+                    if (attr.type == cgltf_attribute_type_position || attr.type == cgltf_attribute_type_normal) {
+                        if (attr.data->count != mesh.vertexNum || attr.data->type != cgltf_type_vec3)
+                            hasMorphTargets = false;
                     }
                 }
-
-                if (!hasPositions || !hasNormals) {
-                    hasMorphTargets = false;
-                    break;
-                }
             }
 
             if (hasMorphTargets) {
@@ -846,8 +3699,13 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
                 mesh.morphTargetVertexOffset = (uint32_t)totalMorphVertexNum;
                 mesh.morphTargetNum = (uint32_t)gltfSubmesh.targets_count;
 
+                if (loadSceneDesc.sparseMorphTargets) {
+                    mesh.morphTargetOffset = (uint32_t)scene.morphTargets.size();
+                    scene.morphTargets.resize(scene.morphTargets.size() + mesh.morphTargetNum);
+                }
+
                 scene.morphIndexNum += mesh.indexNum;
-                totalMorphVertexNum += mesh.vertexNum * mesh.morphTargetNum;
+                totalMorphVertexNum += mesh.vertexNum * GetMorphBlockNum(mesh);
 
                 scene.morphMeshes.push_back(meshIndex);
             }
@@ -857,10 +3715,17 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
     scene.indices.resize(totalIndexNum);
     scene.primitives.resize(totalIndexNum / 3);
     scene.vertices.resize(totalVertexNum);
-    scene.unpackedVertices.resize(totalVertexNum);
+    if (loadSceneDesc.keepUnpackedVertices)
+        scene.unpackedVertices.resize(totalVertexNum);
     scene.morphVertices.resize(totalMorphVertexNum);
 
     // Geometry
+    context.SetStageTotal(SceneLoadingStage::GEOMETRY, (uint32_t)meshNum);
+    context.SetStageTotal(SceneLoadingStage::TANGENTS, (uint32_t)meshNum);
+
+    std::vector<uint32_t> tangentMeshes;
+    std::vector<MorphMesh> morphMeshes;
+
     for (size_t mesh_idx = 0; mesh_idx < objects->meshes_count; mesh_idx++) {
         const cgltf_mesh& gltfMesh = objects->meshes[mesh_idx];
 
@@ -880,38 +3745,9 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
                 assert(gltfSubmesh.indices->type == cgltf_type_scalar);
 
                 auto [indexSrc, indexStride] = cgltfBufferIterator(gltfSubmesh.indices, 0);
+                size_t indexSize = cgltf_component_size(gltfSubmesh.indices->component_type);
 
-                switch (gltfSubmesh.indices->component_type) {
-                    case cgltf_component_type_r_8u:
-                        if (!indexStride)
-                            indexStride = sizeof(uint8_t);
-
-                        for (size_t i_idx = 0; i_idx < mesh.indexNum; i_idx++) {
-                            scene.indices[mesh.indexOffset + i_idx] = (Index)(*(const uint8_t*)indexSrc);
-                            indexSrc += indexStride;
-                        }
-                        break;
-                    case cgltf_component_type_r_16u:
-                        if (!indexStride)
-                            indexStride = sizeof(uint16_t);
-
-                        for (size_t i_idx = 0; i_idx < mesh.indexNum; i_idx++) {
-                            scene.indices[mesh.indexOffset + i_idx] = (Index)(*(const uint16_t*)indexSrc);
-                            indexSrc += indexStride;
-                        }
-                        break;
-                    case cgltf_component_type_r_32u:
-                        if (!indexStride)
-                            indexStride = sizeof(uint32_t);
-
-                        for (size_t i_idx = 0; i_idx < mesh.indexNum; i_idx++) {
-                            scene.indices[mesh.indexOffset + i_idx] = (Index)(*(const uint32_t*)indexSrc);
-                            indexSrc += indexStride;
-                        }
-                        break;
-                    default:
-                        assert(false);
-                }
+                WidenIndices(indexSrc, indexStride ? indexStride : indexSize, indexSize, mesh.indexNum, &scene.indices[mesh.indexOffset]);
             } else {
                 // Unindexed geometry
                 for (size_t i_idx = 0; i_idx < mesh.vertexNum; i_idx++)
@@ -1013,88 +3849,73 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
                     auto [normalSrc, normalStride] = cgltfBufferIterator(normals, sizeof(float) * 3);
                     auto [texcoordSrc, texcoordStride] = cgltfBufferIterator(texcoords, sizeof(float) * 2);
 
-                    for (size_t v_idx = 0; v_idx < mesh.vertexNum; v_idx++) {
-                        float3 pos((float*)positionSrc);
-                        positionSrc += positionStride;
+                    PackVertices(positionSrc, positionStride, normalSrc, normalStride, texcoordSrc, texcoordStride, mesh.vertexNum, &scene.vertices[mesh.vertexOffset], HasUnpackedVertices(scene, mesh) ? &scene.unpackedVertices[mesh.vertexOffset] : nullptr, mesh.aabb);
+                }
+            }
 
-                        float3 N = float3(0.0f, 0.0f, 1.0f);
-                        if (normalSrc) {
-                            N = float3((float*)normalSrc);
-                            N = normalize(N);
-                            normalSrc += normalStride;
-                        }
+            if (mesh.HasMorphTargets()) {
+                MorphMesh& morphMesh = morphMeshes.emplace_back();
+                morphMesh.meshIndex = (uint32_t)meshIndex;
+                morphMesh.gltfPrimitive = &gltfSubmesh;
+            }
 
-                        float u = 0.0f;
-                        float v = 0.0f;
-                        if (texcoordSrc) {
-                            const float* uv = (float*)texcoordSrc;
-                            u = uv[0];
-                            v = uv[1];
-                            texcoordSrc += texcoordStride;
-                        }
+            context.AdvanceStage(SceneLoadingStage::GEOMETRY);
 
-                        UnpackedVertex& unpackedVertex = scene.unpackedVertices[mesh.vertexOffset + v_idx];
-                        unpackedVertex.pos[0] = pos.x;
-                        unpackedVertex.pos[1] = pos.y;
-                        unpackedVertex.pos[2] = pos.z;
-                        unpackedVertex.N[0] = N.x;
-                        unpackedVertex.N[1] = N.y;
-                        unpackedVertex.N[2] = N.z;
-                        unpackedVertex.uv[0] = u;
-                        unpackedVertex.uv[1] = v;
-                        // T is computed in "GeneratePrimitiveDataAndTangents"
-
-                        Vertex& vertex = scene.vertices[mesh.vertexOffset + v_idx];
-                        vertex.pos[0] = pos.x;
-                        vertex.pos[1] = pos.y;
-                        vertex.pos[2] = pos.z;
-                        vertex.N = Packing::float4_to_unorm<10, 10, 10, 2>(float4(N * 0.5f + 0.5f, 0.0f));
-                        vertex.uv = float2(float2(u, v));
-
-                        mesh.aabb.Add(pos);
-                    }
-                }
-            }
+            if (gltfSubmesh.type != cgltf_primitive_type_lines)
+                tangentMeshes.push_back((uint32_t)meshIndex);
+            else
+                context.AdvanceStage(SceneLoadingStage::TANGENTS);
+        }
+    }
 
-            { // Morph targets
-                for (uint32_t target_idx = 0; target_idx < gltfSubmesh.targets_count; target_idx++) {
-                    const cgltf_morph_target& target = gltfSubmesh.targets[target_idx];
-                    const cgltf_accessor* target_positions = nullptr;
-                    const cgltf_accessor* target_normals = nullptr;
+    GenerateSceneMorphTargets(scene, morphMeshes);
+    morphMeshes = {};
 
-                    for (size_t attr_idx = 0; attr_idx < target.attributes_count; attr_idx++) {
-                        const cgltf_attribute& attr = target.attributes[attr_idx];
+    if (loadSceneDesc.optimizeMeshes && meshNum)
+        OptimizeSceneMeshes(scene, meshOffset, tangentMeshes);
 
-                        switch (attr.type) {
-                            case cgltf_attribute_type_position:
-                                assert(attr.data->type == cgltf_type_vec3);
-                                assert(attr.data->component_type == cgltf_component_type_r_32f);
-                                target_positions = attr.data;
-                                break;
-                            case cgltf_attribute_type_normal:
-                                assert(attr.data->type == cgltf_type_vec3);
-                                assert(attr.data->component_type == cgltf_component_type_r_32f);
-                                target_normals = attr.data;
-                                break;
-                            default:
-                                break;
-                        }
-                    }
+    if (loadSceneDesc.sparseMorphTargets && meshNum)
+        SparsifyMorphTargets(scene, meshOffset);
+
+    { // Per primitive data and tangents
+        std::vector<TangentScratch> tangentScratch(GetThreadNum());
+        std::vector<uint32_t> bigMeshes;
+        std::vector<uint32_t> smallMeshes;
+
+        for (uint32_t meshIndex : tangentMeshes) {
+            if (scene.meshes[meshIndex].indexNum / 3 >= PARALLEL_TANGENTS_MIN_PRIMITIVE_NUM)
+                bigMeshes.push_back(meshIndex);
+            else
+                smallMeshes.push_back(meshIndex);
+        }
+
+        ParallelFor((uint32_t)smallMeshes.size(), 1, [&](uint32_t begin, uint32_t end, uint32_t threadIndex) {
+            for (uint32_t i = begin; i < end; i++) {
+                GeneratePrimitiveDataAndTangents(scene, scene.meshes[smallMeshes[i]], tangentScratch[threadIndex]);
+                context.AdvanceStage(SceneLoadingStage::TANGENTS);
+            }
+        });
+
+        for (uint32_t meshIndex : bigMeshes) {
+            GeneratePrimitiveDataAndTangentsParallel(scene, scene.meshes[meshIndex], tangentScratch[0]);
+            context.AdvanceStage(SceneLoadingStage::TANGENTS);
+        }
+    }
+
+    if (loadSceneDesc.generateCompactVertices && meshNum)
+        PackCompactVertices(scene, meshOffset);
 
-                    assert(target_positions && target_normals);
+    if (loadSceneDesc.generateVertexStreams && meshNum)
+        PackVertexStreams(scene, meshOffset);
 
-                    auto [positionSrc, positionStride] = cgltfBufferIterator(target_positions, sizeof(float) * 3);
-                    auto [normalSrc, normalStride] = cgltfBufferIterator(target_normals, sizeof(float) * 3);
+    if (loadSceneDesc.lodNum && meshNum)
+        GenerateSceneLods(scene, tangentMeshes, loadSceneDesc.lodNum);
 
-                    GenerateMorphTargetVertices(scene, mesh, target_idx, positionSrc, positionStride, normalSrc, normalStride);
-                }
-            }
+    if (loadSceneDesc.meshletMaxVertexNum && meshNum)
+        GenerateSceneMeshlets(scene, meshOffset, loadSceneDesc.meshletMaxVertexNum, loadSceneDesc.meshletMaxPrimitiveNum);
 
-            // Per primitive data and tangents
-            if (gltfSubmesh.type != cgltf_primitive_type_lines)
-                GeneratePrimitiveDataAndTangents(scene, mesh);
-        }
-    }
+    if (loadSceneDesc.allow16BitIndices && meshNum)
+        CompactSceneIndices(scene, meshOffset);
 
     // Walk through the nodes and fill instances
     const uint32_t instanceOffset = (uint32_t)scene.instances.size();
@@ -1189,7 +4010,7 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
                 instance.position = position;
                 instance.rotation = transform;
                 instance.materialIndex = (uint32_t)(materialOffset + materialIndex);
-                instance.allowUpdate = allowUpdate || m.HasMorphTargets();
+                instance.allowUpdate = loadSceneDesc.allowUpdate || m.HasMorphTargets();
 
                 vec.push_back((uint32_t)(scene.instances.size() - 1));
 
@@ -1210,69 +4031,74 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
     for (cgltf_size nodeIndex = 0; nodeIndex < objects->scene->nodes_count; ++nodeIndex)
         traverseNode(objects->scene->nodes[nodeIndex], scene.mSceneToWorld);
 
+    context.CompleteStage(SceneLoadingStage::GEOMETRY);
+    context.CompleteStage(SceneLoadingStage::TANGENTS);
+
     // TODO: properly update "allowUpdate"
-    if (objects->animations_count) {
-        for (uint32_t animIndex = 0; animIndex < objects->animations_count; ++animIndex) {
-            cgltf_animation* gltfAnim = objects->animations + animIndex;
+    context.SetStageTotal(SceneLoadingStage::ANIMATIONS, (uint32_t)objects->animations_count);
 
-            scene.animations.push_back(Animation());
-            Animation& animation = scene.animations.back();
-            animation.name = gltfAnim->name ? gltfAnim->name : "";
+    if (objects->animations_count) {
+        // Setup the scene graph shared by all animations, nodes are flattened in depth-first order
+        std::vector<uint32_t> nodeRemap(objects->nodes_count, InvalidIndex);
+        scene.sceneNodes.reserve(objects->nodes_count);
+
+        std::function<void(cgltf_node*, uint32_t)> flattenNode = [&](cgltf_node* gltfNode, uint32_t parentIndex) {
+            uint32_t nodeIndex = (uint32_t)scene.sceneNodes.size();
+            nodeRemap[gltfNode - objects->nodes] = nodeIndex;
+
+            SceneNode& sceneNode = scene.sceneNodes.emplace_back();
+            sceneNode.parentIndex = parentIndex;
+
+            if (gltfNode->has_matrix) {
+                const auto& tr = gltfNode->matrix;
+                float4x4 transform(
+                    tr[0], tr[4], tr[8], tr[12],
+                    tr[1], tr[5], tr[9], tr[13],
+                    tr[2], tr[6], tr[10], tr[14],
+                    tr[3], tr[7], tr[11], tr[15]);
+                DecomposeAffine(transform, sceneNode.translation, sceneNode.rotation, sceneNode.scale);
+            } else {
+                sceneNode.translation = gltfNode->has_translation ? float3(gltfNode->translation) : float3(0.0f, 0.0f, 0.0f);
+                sceneNode.rotation = gltfNode->has_rotation ? float4(gltfNode->rotation) : float4(0.0f, 0.0f, 0.0f, 1.0f);
+                sceneNode.scale = gltfNode->has_scale ? float3(gltfNode->scale) : float3(1.0f, 1.0f, 1.0f);
+            }
 
-            { // Setup scene graph
-                animation.sceneNodes.resize(objects->nodes_count);
-                for (uint32_t nodeIndex = 0; nodeIndex < objects->nodes_count; ++nodeIndex) {
-                    cgltf_node* gltfNode = objects->nodes + nodeIndex;
-                    SceneNode& sceneNode = animation.sceneNodes[nodeIndex];
+            float4x4 translation;
+            translation.SetupByTranslation(sceneNode.translation);
+            float4x4 rotation;
+            rotation.SetupByQuaternion(sceneNode.rotation);
+            float4x4 scale;
+            scale.SetupByScale(sceneNode.scale);
 
-                    sceneNode.children.resize(gltfNode->children_count);
-                    for (uint32_t childIndex = 0; childIndex < gltfNode->children_count; ++childIndex) {
-                        uint32_t index = (uint32_t)(gltfNode->children[childIndex] - objects->nodes);
-                        sceneNode.children[childIndex] = &animation.sceneNodes[index];
-                    }
+            sceneNode.localTransform = translation * (rotation * scale);
+            sceneNode.worldTransform = parentIndex != InvalidIndex ? (scene.sceneNodes[parentIndex].worldTransform * sceneNode.localTransform) : (scene.mSceneToWorld * sceneNode.localTransform);
 
-                    if (gltfNode->has_matrix) {
-                        const auto& tr = gltfNode->matrix;
-                        float4x4 transform(
-                            tr[0], tr[4], tr[8], tr[12],
-                            tr[1], tr[5], tr[9], tr[13],
-                            tr[2], tr[6], tr[10], tr[14],
-                            tr[3], tr[7], tr[11], tr[15]);
-                        DecomposeAffine(transform, sceneNode.translation, sceneNode.rotation, sceneNode.scale);
-                    } else {
-                        sceneNode.translation = gltfNode->has_translation ? float3(gltfNode->translation) : float3(0.0f, 0.0f, 0.0f);
-                        sceneNode.rotation = gltfNode->has_rotation ? float4(gltfNode->rotation) : float4(0.0f, 0.0f, 0.0f, 1.0f);
-                        sceneNode.scale = gltfNode->has_scale ? float3(gltfNode->scale) : float3(1.0f, 1.0f, 1.0f);
-                    }
+            if (gltfNode->mesh) {
+                sceneNode.instances = nodeToInstanceMap[gltfNode];
+                sceneNode.name = gltfNode->mesh->name ? gltfNode->mesh->name : ""; // TODO: gltfNode->name?
+            }
 
-                    float4x4 translation;
-                    translation.SetupByTranslation(sceneNode.translation);
-                    float4x4 rotation;
-                    rotation.SetupByQuaternion(sceneNode.rotation);
-                    float4x4 scale;
-                    scale.SetupByScale(sceneNode.scale);
+            for (cgltf_size childIndex = 0; childIndex < gltfNode->children_count; ++childIndex)
+                flattenNode(gltfNode->children[childIndex], nodeIndex);
 
-                    sceneNode.localTransform = translation * (rotation * scale);
+            scene.sceneNodes[nodeIndex].descendantNum = (uint32_t)scene.sceneNodes.size() - nodeIndex - 1;
+        };
 
-                    if (gltfNode->mesh) {
-                        sceneNode.instances = nodeToInstanceMap[gltfNode];
-                        sceneNode.name = gltfNode->mesh->name ? gltfNode->mesh->name : ""; // TODO: gltfNode->name?
-                    }
-                }
+        for (cgltf_size nodeIndex = 0; nodeIndex < objects->scene->nodes_count; ++nodeIndex)
+            flattenNode(objects->scene->nodes[nodeIndex], InvalidIndex);
 
-                std::function<void(SceneNode*, SceneNode*)> setupGraphNodes = [&](SceneNode* parentNode, SceneNode* node) {
-                    node->worldTransform = parentNode ? (parentNode->worldTransform * node->localTransform) : (scene.mSceneToWorld * node->localTransform);
-                    node->parent = parentNode;
+        // Nodes outside of the scene can still be animated
+        for (cgltf_size nodeIndex = 0; nodeIndex < objects->nodes_count; ++nodeIndex) {
+            if (!objects->nodes[nodeIndex].parent && nodeRemap[nodeIndex] == InvalidIndex)
+                flattenNode(objects->nodes + nodeIndex, InvalidIndex);
+        }
 
-                    for (auto child : node->children)
-                        setupGraphNodes(node, child);
-                };
+        for (uint32_t animIndex = 0; animIndex < objects->animations_count; ++animIndex) {
+            cgltf_animation* gltfAnim = objects->animations + animIndex;
 
-                for (cgltf_size nodeIndex = 0; nodeIndex < objects->scene->nodes_count; ++nodeIndex) {
-                    uint32_t idx = (uint32_t)(objects->scene->nodes[nodeIndex] - objects->nodes);
-                    setupGraphNodes(nullptr, &animation.sceneNodes[idx]);
-                }
-            }
+            scene.animations.push_back(Animation());
+            Animation& animation = scene.animations.back();
+            animation.name = gltfAnim->name ? gltfAnim->name : "";
 
             float animationTotalSec = 0.0f;
             for (uint32_t samplerIndex = 0; samplerIndex < gltfAnim->samplers_count; ++samplerIndex) {
@@ -1295,69 +4121,46 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
                 }
             };
 
+            std::vector<AnimationChannel> channels;
             for (uint32_t channelIndex = 0; channelIndex < gltfAnim->channels_count; ++channelIndex) {
                 cgltf_animation_channel* animChannel = gltfAnim->channels + channelIndex;
 
-                uint32_t index = (uint32_t)(animChannel->target_node - objects->nodes);
-                SceneNode* sceneNode = animation.sceneNodes.data() + index;
+                uint32_t index = nodeRemap[animChannel->target_node - objects->nodes];
+                SceneNode* sceneNode = scene.sceneNodes.data() + index;
 
                 if (animChannel->sampler->input->count == 0)
                     continue;
 
-                if (std::find(animation.dynamicNodes.begin(), animation.dynamicNodes.end(), sceneNode) == animation.dynamicNodes.end())
-                    animation.dynamicNodes.push_back(sceneNode);
+                animation.dynamicNodes.push_back(index);
 
                 switch (animChannel->target_path) {
                     case cgltf_animation_path_type_translation:
+                    case cgltf_animation_path_type_rotation:
                     case cgltf_animation_path_type_scale: {
-                        bool isPosition = animChannel->target_path == cgltf_animation_path_type_translation;
-                        if (isPosition)
-                            animation.positionTracks.push_back(VectorAnimationTrack());
-                        else
-                            animation.scaleTracks.push_back(VectorAnimationTrack());
-
-                        VectorAnimationTrack& track = isPosition ? animation.positionTracks.back() : animation.scaleTracks.back();
+                        AnimationChannel& channel = channels.emplace_back();
                         uint32_t frameCount = (uint32_t)animChannel->sampler->input->count;
 
-                        track.node = sceneNode;
-                        track.type = convertTrackType(animChannel->sampler->interpolation);
-                        auto [keysSrc, keysStride] = cgltfBufferIterator(animChannel->sampler->input, sizeof(float));
-                        auto [valuesSrc, valuesStride] = cgltfBufferIterator(animChannel->sampler->output, sizeof(float) * 3);
-                        track.keys.reserve(frameCount);
-                        track.values.reserve(frameCount);
-                        for (uint32_t frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
-                            float key = *(float*)keysSrc;
-                            keysSrc += keysStride;
-                            track.keys.push_back(key);
-
-                            float3 value = float3((float*)valuesSrc);
-                            valuesSrc += valuesStride;
-                            track.values.push_back(value);
-                        }
-                        track.frameCount = frameCount;
-                    } break;
-
-                    case cgltf_animation_path_type_rotation: {
-                        animation.rotationTracks.push_back(QuatAnimationTrack());
-                        QuatAnimationTrack& track = animation.rotationTracks.back();
-                        uint32_t frameCount = (uint32_t)animChannel->sampler->input->count;
+                        channel.nodeIndex = index;
+                        channel.type = convertTrackType(animChannel->sampler->interpolation);
+                        if (animChannel->target_path == cgltf_animation_path_type_translation)
+                            channel.target = AnimationTrackTarget::TRANSLATION;
+                        else if (animChannel->target_path == cgltf_animation_path_type_rotation)
+                            channel.target = AnimationTrackTarget::ROTATION;
+                        else
+                            channel.target = AnimationTrackTarget::SCALE;
 
-                        track.node = sceneNode;
-                        track.type = convertTrackType(animChannel->sampler->interpolation);
+                        uint32_t componentNum = channel.target == AnimationTrackTarget::ROTATION ? 4 : 3;
                         auto [keysSrc, keysStride] = cgltfBufferIterator(animChannel->sampler->input, sizeof(float));
-                        auto [valuesSrc, valuesStride] = cgltfBufferIterator(animChannel->sampler->output, sizeof(float) * 4);
-                        track.keys.reserve(frameCount);
-                        track.values.reserve(frameCount);
+                        auto [valuesSrc, valuesStride] = cgltfBufferIterator(animChannel->sampler->output, sizeof(float) * componentNum);
+                        channel.keys.resize(frameCount);
+                        channel.values.resize(frameCount * componentNum);
                         for (uint32_t frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
-                            float key = *(float*)keysSrc;
+                            channel.keys[frameIndex] = *(float*)keysSrc;
                             keysSrc += keysStride;
-                            track.keys.push_back(key);
 
-                            float4 value = float4((float*)valuesSrc);
+                            memcpy(&channel.values[frameIndex * componentNum], valuesSrc, sizeof(float) * componentNum);
                             valuesSrc += valuesStride;
-                            track.values.push_back(value);
                         }
-                        track.frameCount = frameCount;
                     } break;
 
                     case cgltf_animation_path_type_weights: {
@@ -1412,82 +4215,34 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
                         break;
                 }
             }
-        }
-    }
-
-    uint32_t textureNum = (uint32_t)objects->textures_count;
-    size_t newCapacity = scene.textures.size() + textureNum;
-    scene.textures.reserve(newCapacity);
-
-    if (scene.textures.empty()) {
-        { // StaticTexture::Black
-            Texture* texture = new Texture;
-            const std::string& texPath = GetFullPath("black.png", DataFolder::TEXTURES);
-            NRI_ABORT_ON_FALSE(LoadTexture(texPath, *texture));
-            scene.textures.push_back(texture);
-        }
 
-        { // StaticTexture::White
-            Texture* texture = new Texture;
-            const std::string& texPath = GetFullPath("white.png", DataFolder::TEXTURES);
-            NRI_ABORT_ON_FALSE(LoadTexture(texPath, *texture));
-            scene.textures.push_back(texture);
-        }
+            CompileAnimationTracks(animation, channels, loadSceneDesc.compressAnimations);
 
-        { // StaticTexture::Invalid
-            Texture* texture = new Texture;
-            const std::string& texPath = GetFullPath("checkerboard0.dds", DataFolder::TEXTURES);
-            NRI_ABORT_ON_FALSE(LoadTexture(texPath, *texture, true));
-            scene.textures.push_back(texture);
-        }
+            std::sort(animation.dynamicNodes.begin(), animation.dynamicNodes.end());
+            animation.dynamicNodes.erase(std::unique(animation.dynamicNodes.begin(), animation.dynamicNodes.end()), animation.dynamicNodes.end());
 
-        { // StaticTexture::FlatNormal
-            Texture* texture = new Texture;
-            const std::string& texPath = GetFullPath("flatnormal.png", DataFolder::TEXTURES);
-            NRI_ABORT_ON_FALSE(LoadTexture(texPath, *texture));
-            scene.textures.push_back(texture);
+            context.AdvanceStage(SceneLoadingStage::ANIMATIONS);
         }
+    }
 
-        // TODO: Metal complains that "RGBA8_UINT" can't be cast to "float" despite the fact that all static textures are
-        // never accessed as material textures for objects rendering. Better separate static textures and material textures
-#if (NRIF_PLATFORM == NRIF_COCOA)
-        constexpr bool overrideFormat = false;
-#else
-        constexpr bool overrideFormat = true;
-#endif
-
-        // StaticTexture::ScramblingRanking (all)
-        for( uint32_t i = 2; i <= 8; i++)
-        {
-            char s[256];
-            snprintf(s, sizeof(s), "scrambling_ranking_128x128_2d_%uspp.png", 1 << i);
+    context.CompleteStage(SceneLoadingStage::ANIMATIONS);
 
-            Texture* texture = new Texture;
-            const std::string& texPath = GetFullPath(s, DataFolder::TEXTURES);
-            NRI_ABORT_ON_FALSE(LoadTexture(texPath, *texture));
-            if (overrideFormat)
-                texture->OverrideFormat(nri::Format::RGBA8_UINT);
-            scene.textures.push_back(texture);
-        }
+    if (scene.textures.empty())
+        LoadStaticTextures(scene);
 
-        { // StaticTexture::SobolSequence
-            Texture* texture = new Texture;
-            const std::string& texPath = GetFullPath("sobol_256_4d.png", DataFolder::TEXTURES);
-            NRI_ABORT_ON_FALSE(LoadTexture(texPath, *texture));
-            if (overrideFormat)
-                texture->OverrideFormat(nri::Format::RGBA8_UINT);
-            scene.textures.push_back(texture);
-        }
-    }
+    // Materials (textures are requested here, but decoded later)
+    std::vector<SceneTextureRequest>& textureRequests = context.textureRequests;
+    std::vector<SceneMaterialTextures>& materialTextures = context.materialTextures;
+    materialTextures.resize(materialNum);
+    context.materialOffset = materialOffset;
 
-    // Materials
     std::unordered_map<const cgltf_image*, uint32_t> textures;
+
     for (uint32_t i = 0; i < materialNum; i++) {
         Material& material = scene.materials[materialOffset + i];
 
         const cgltf_material& gltfMaterial = objects->materials[i];
 
-        uint32_t* textureIndices = &material.baseColorTexIndex;
         cgltf_texture* maps[4] = {nullptr};
 
         if (gltfMaterial.has_pbr_metallic_roughness) {
@@ -1505,10 +4260,9 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
             maps[1] = gltfMaterial.pbr_specular_glossiness.specular_glossiness_texture.texture;
         }
 
-        bool useTransmission = false;
         if (gltfMaterial.has_transmission) {
             // TODO: use "gltfMaterial.transmission"
-            useTransmission = true;
+            materialTextures[i].useTransmission = true;
         }
 
         maps[2] = gltfMaterial.normal_texture.texture;
@@ -1537,68 +4291,33 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
             // Pick either DDS or standard image, prefer DDS
             const cgltf_image* activeImage = (ddsImage && (ddsImage->uri || ddsImage->buffer_view)) ? ddsImage : texture->image;
 
-            // Load a texture if not already loaded
-            uint32_t textureIndex = 0;
-
+            // Request a texture if not already requested (the first request defines loading settings)
             auto it = textures.find(activeImage);
             if (it == textures.end()) {
-                Texture* tex = new Texture;
+                it = textures.insert({activeImage, (uint32_t)textureRequests.size()}).first;
 
-                const bool computeAlphaMode = j == 0;
-                const bool makeSRGB = j != 2;
+                SceneTextureRequest& request = textureRequests.emplace_back();
+                request.computeAlphaMode = j == 0;
+                request.makeSRGB = j != 2;
 
-                bool isLoaded = false;
                 if (activeImage->buffer_view) {
-                    assert(activeImage->buffer_view->size < std::numeric_limits<int>::max());
-
-                    const uint8_t* data = ((const uint8_t*)activeImage->buffer_view->buffer->data) + activeImage->buffer_view->offset;
-                    isLoaded = LoadTextureFromMemory(std::string(activeImage->name), data,
-                        (int)activeImage->buffer_view->size, *tex, computeAlphaMode);
-                } else {
-                    std::string filename = (normPath.parent_path() / activeImage->uri).string();
-                    isLoaded = LoadTexture(filename, *tex, computeAlphaMode);
-                    if (!isLoaded) {
-                        std::string filenameDDS = filename.substr(0, filename.find_last_of('.')) + ".dds";
-                        isLoaded = LoadTexture(filenameDDS, *tex, computeAlphaMode);
-                    }
-                }
-
-                if (isLoaded) {
-                    if (makeSRGB)
-                        tex->OverrideFormat(MakeSRGBFormat(tex->format));
-
-                    textureIndex = (uint32_t)scene.textures.size();
-                    scene.textures.push_back(tex);
-
-                    textures[activeImage] = textureIndex;
+                    request.path = activeImage->name ? activeImage->name : "";
+                    request.data = (const uint8_t*)activeImage->buffer_view->buffer->data + activeImage->buffer_view->offset;
+                    request.dataSize = activeImage->buffer_view->size;
                 } else
-                    delete tex;
-            } else
-                textureIndex = it->second;
+                    request.path = (normPath.parent_path() / activeImage->uri).string();
+            }
 
-            textureIndices[j] = textureIndex;
+            materialTextures[i].requestIndices[j] = it->second;
         }
 
-        if (material.emissiveTexIndex == StaticTexture::Black && (material.emissiveAndRoughnessScale.x != 0.0f || material.emissiveAndRoughnessScale.y != 0.0f || material.emissiveAndRoughnessScale.z != 0.0f))
-            material.emissiveTexIndex = StaticTexture::White;
-
-        if (material.baseColorTexIndex == StaticTexture::Black && (material.baseColorAndMetalnessScale.x != 0.0f || material.baseColorAndMetalnessScale.y != 0.0f || material.baseColorAndMetalnessScale.z != 0.0f))
-            material.baseColorTexIndex = StaticTexture::White;
-
-        if (material.roughnessMetalnessTexIndex == StaticTexture::Black && (material.emissiveAndRoughnessScale.w != 0.0f || material.baseColorAndMetalnessScale.w != 0.0f))
-            material.roughnessMetalnessTexIndex = StaticTexture::White;
-
-        const Texture* diffuseTexture = scene.textures[material.baseColorTexIndex];
-        material.alphaMode = useTransmission ? AlphaMode::TRANSPARENT : diffuseTexture->alphaMode;
-
         // TODO: hacks
         material.isHair = strstr(gltfMaterial.name, "_hair") != 0 || strstr(gltfMaterial.name, "OmniHairBase") != 0;
         material.isLeaf = strstr(gltfMaterial.name, "Foliage") != 0;
         material.isSkin = strstr(gltfMaterial.name, "_skin") != 0;
 
         // TODO: remove strange polygon on the window in Kitchen scene
-        if (strstr(gltfMaterial.name, "Material_295"))
-            material.alphaMode = AlphaMode::OFF;
+        materialTextures[i].isAlphaOff = strstr(gltfMaterial.name, "Material_295") != 0;
 
         /*
         switch (gltfMaterial.alpha_mode)
@@ -1616,29 +4335,278 @@ bool utils::LoadScene(const std::string& path, Scene& scene, bool allowUpdate) {
         */
     }
 
-    // Set "Instance::allowUpdate" state
-    std::function<void(SceneNode*)> setAllowUpdate = [&](SceneNode* sceneNode) {
-        for (auto instanceIndex : sceneNode->instances) {
-            Instance& instance = scene.instances[instanceIndex];
-            instance.allowUpdate = true;
+    // Set "Instance::allowUpdate" state (for instances in subtrees of dynamic nodes)
+    for (Animation& animation : scene.animations) {
+        for (uint32_t nodeIndex : animation.dynamicNodes) {
+            uint32_t nodeEnd = nodeIndex + scene.sceneNodes[nodeIndex].descendantNum + 1;
+            for (uint32_t i = nodeIndex; i < nodeEnd; i++) {
+                for (uint32_t instanceIndex : scene.sceneNodes[i].instances)
+                    scene.instances[instanceIndex].allowUpdate = true;
+            }
         }
+    }
 
-        for (auto child : sceneNode->children)
-            setAllowUpdate(child);
-    };
-
-    for (Animation& animation : scene.animations) {
-        for (auto node : animation.dynamicNodes)
-            setAllowUpdate(node);
+    // Materials are cached before texture indices get resolved, since textures are decoded on every load
+    if (useCache) {
+        cacheHeader.sourceHash = HashBytes(files[0].GetData(), files[0].GetSize());
+        SaveSceneCache(cachePath, normPath.parent_path(), cacheHeader, dependencies, scene, textureRequests, materialTextures);
     }
 
-    // Cleanup
-    cgltf_free(objects);
+    std::vector<uint32_t> pendingTextureIndices(textureRequests.size(), InvalidIndex);
+    ResolveSceneMaterials(context, pendingTextureIndices);
 
     return true;
 }
+} // namespace utils
+
+bool utils::LoadScene(const std::string& path, Scene& scene, const LoadSceneDesc& loadSceneDesc) {
+    SceneLoadingContext context;
+    context.path = path;
+    context.desc = loadSceneDesc;
+    context.scene = &scene;
+
+    if (!LoadSceneGeometry(context))
+        return false;
+
+    DecodeSceneTextures(context);
+    CommitSceneTextures(context);
+
+    return true;
+}
+
+utils::LoadSceneHandle utils::LoadSceneAsync(const std::string& path, Scene& scene, const LoadSceneDesc& loadSceneDesc) {
+    SceneLoadingContext* context = new SceneLoadingContext;
+    context->path = path;
+    context->desc = loadSceneDesc;
+    context->scene = &scene;
+
+    context->thread = std::thread([context]() {
+        context->result = LoadSceneGeometry(*context);
+        context->isGeometryReady = context->result;
+
+        // The scene belongs to the caller from now on, decoded textures are kept aside until "Finish"
+        if (context->result)
+            DecodeSceneTextures(*context);
+
+        context->isDone = true;
+    });
+
+    return LoadSceneHandle(context);
+}
+
+utils::LoadSceneHandle::LoadSceneHandle(LoadSceneHandle&& other) noexcept {
+    *this = std::move(other);
+}
+
+utils::LoadSceneHandle& utils::LoadSceneHandle::operator=(LoadSceneHandle&& other) noexcept {
+    if (this != &other) {
+        delete m_Context;
+
+        m_Context = other.m_Context;
+        other.m_Context = nullptr;
+    }
+
+    return *this;
+}
+
+utils::LoadSceneHandle::~LoadSceneHandle() {
+    delete m_Context;
+}
+
+float utils::LoadSceneHandle::GetProgress(SceneLoadingStage stage) const {
+    if (!m_Context)
+        return 0.0f;
+
+    uint32_t total = m_Context->progressTotal[(size_t)stage];
+    uint32_t done = m_Context->progressDone[(size_t)stage];
+
+    return total ? min((float)done / (float)total, 1.0f) : 0.0f;
+}
+
+float utils::LoadSceneHandle::GetProgress() const {
+    float progress = 0.0f;
+    for (uint32_t i = 0; i < (uint32_t)SceneLoadingStage::MAX_NUM; i++)
+        progress += GetProgress((SceneLoadingStage)i);
+
+    return progress / (float)SceneLoadingStage::MAX_NUM;
+}
+
+bool utils::LoadSceneHandle::IsGeometryReady() const {
+    return m_Context && m_Context->isGeometryReady;
+}
+
+bool utils::LoadSceneHandle::IsDone() const {
+    return m_Context && m_Context->isDone;
+}
+
+bool utils::LoadSceneHandle::Finish() {
+    if (!m_Context)
+        return false;
+
+    if (m_Context->thread.joinable())
+        m_Context->thread.join();
+
+    if (m_Context->result && !m_Context->isCommitted)
+        CommitSceneTextures(*m_Context);
+
+    return m_Context->result;
+}
+
+// The last key not greater than "time", the previous result is checked first (with neighbors for playback in both directions)
+static inline uint32_t FindKeyIndex(const float* keys, uint32_t keyNum, float time, uint32_t& cursor) {
+    if (time <= keys[0])
+        cursor = 0;
+    else if (time >= keys[keyNum - 1])
+        cursor = keyNum - 1;
+    else {
+        // "keys[i] <= time < keys[i + 1]"
+        uint32_t i = min(cursor, keyNum - 2);
+        if (keys[i] <= time) {
+            if (time >= keys[i + 1]) {
+                if (time < keys[i + 2]) // "i + 1 < keyNum - 1", since "time < keys[keyNum - 1]"
+                    i++;
+                else
+                    i = utils::InvalidIndex;
+            }
+        } else if (i && keys[i - 1] <= time)
+            i--;
+        else
+            i = utils::InvalidIndex;
+
+        // Jump
+        if (i == utils::InvalidIndex)
+            i = (uint32_t)(std::upper_bound(keys, keys + keyNum, time) - keys) - 1;
+
+        cursor = i;
+    }
+
+    return cursor;
+}
+
+// Polynomial SLERP without trigonometry (Eberly, "A fast and accurate algorithm for computing SLERP"), "x" is "dot(q0, q1) - 1"
+constexpr float SLERP_MU = 1.85298109240830f;
+static const float SLERP_U[8] = {1.0f / (1 * 3), 1.0f / (2 * 5), 1.0f / (3 * 7), 1.0f / (4 * 9), 1.0f / (5 * 11), 1.0f / (6 * 13), 1.0f / (7 * 15), SLERP_MU / (8 * 17)};
+static const float SLERP_V[8] = {1.0f / 3, 2.0f / 5, 3.0f / 7, 4.0f / 9, 5.0f / 11, 6.0f / 13, 7.0f / 15, SLERP_MU * 8 / 17};
+
+static inline __m128 SlerpWeight(__m128 t, __m128 x) {
+    __m128 t2 = _mm_mul_ps(t, t);
+    __m128 one = _mm_set1_ps(1.0f);
+
+    __m128 r = one;
+    for (int32_t i = 7; i >= 0; i--) {
+        __m128 b = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(SLERP_U[i]), t2), _mm_set1_ps(SLERP_V[i])), x);
+        r = _mm_add_ps(one, _mm_mul_ps(b, r));
+    }
+
+    return _mm_mul_ps(t, r);
+}
+
+// SoA values of a key, quantized values are decoded
+static inline void LoadTrackGroupKey(const utils::Animation& animation, const utils::AnimationTrackGroup& group, uint32_t key, __m128 (&v)[4]) {
+    bool isRotation = group.target == utils::AnimationTrackTarget::ROTATION;
+
+    if (!group.isQuantized) {
+        uint32_t componentNum = isRotation ? 4 : 3;
+        const float* src = animation.values.data() + group.valueOffset + key * componentNum * 4;
+
+        for (uint32_t c = 0; c < componentNum; c++)
+            v[c] = _mm_loadu_ps(src + c * 4);
+
+        return;
+    }
+
+    const uint16_t* src = animation.quantizedValues.data() + group.valueOffset + key * 12;
+
+    __m128i q[3];
+    for (uint32_t c = 0; c < 3; c++)
+        q[c] = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(src + c * 4)), _mm_setzero_si128());
+
+    if (isRotation) {
+        __m128i one = _mm_set1_epi32(1);
+        __m128i omitted = _mm_or_si128(_mm_and_si128(q[0], one), _mm_slli_epi32(_mm_and_si128(q[1], one), 1));
+
+        __m128 bias = _mm_set1_ps(-SQRT_HALF);
+        __m128 x = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(q[0], 1)), _mm_set1_ps(2.0f * SQRT_HALF / 32767.0f)), bias);
+        __m128 y = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(q[1], 1)), _mm_set1_ps(2.0f * SQRT_HALF / 32767.0f)), bias);
+        __m128 z = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(q[2]), _mm_set1_ps(2.0f * SQRT_HALF / 65535.0f)), bias);
+
+        __m128 lenSq = _mm_add_ps(_mm_mul_ps(x, x), _mm_add_ps(_mm_mul_ps(y, y), _mm_mul_ps(z, z)));
+        __m128 w = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.0f), lenSq), _mm_setzero_ps()));
+
+        // Stored components fill the slots around the omitted one
+        __m128 rest[3] = {x, y, z};
+        for (int32_t c = 0; c < 4; c++) {
+            __m128 isOmitted = _mm_castsi128_ps(_mm_cmpeq_epi32(omitted, _mm_set1_epi32(c)));
+            __m128 isAfter = _mm_castsi128_ps(_mm_cmpgt_epi32(omitted, _mm_set1_epi32(c)));
+
+            __m128 shifted = c > 0 ? rest[c - 1] : w;
+            __m128 direct = c < 3 ? rest[c] : w;
+            v[c] = Select(Select(shifted, direct, isAfter), w, isOmitted);
+        }
+    } else {
+        const float* range = animation.values.data() + group.rangeOffset;
+
+        for (uint32_t c = 0; c < 3; c++)
+            v[c] = _mm_add_ps(_mm_loadu_ps(range + c * 4), _mm_mul_ps(_mm_cvtepi32_ps(q[c]), _mm_loadu_ps(range + 12 + c * 4)));
+    }
+}
+
+// Evaluates 4 tracks at once, "result" is SoA
+static void EvaluateTrackGroup(const utils::Animation& animation, const utils::AnimationTrackGroup& group, float animTimeSec, uint32_t& keyCursor, float (&result)[4][4]) {
+    const float* keys = animation.keys.data() + group.keyOffset;
+
+    uint32_t from = FindKeyIndex(keys, group.keyNum, animTimeSec, keyCursor);
+    uint32_t to = min(group.keyNum - 1, from + 1);
+    float keyFrom = keys[from];
+    float keyTo = keys[to];
+    float time = animTimeSec < keyFrom ? keyFrom : (animTimeSec > keyTo ? keyTo : animTimeSec);
+    float factor = to != from ? (time - keyFrom) / (keyTo - keyFrom) : 0.0f;
+
+    bool isRotation = group.target == utils::AnimationTrackTarget::ROTATION;
+    uint32_t componentNum = isRotation ? 4 : 3;
+
+    __m128 v[4];
+    LoadTrackGroupKey(animation, group, from, v);
+
+    if (group.type != utils::AnimationTrackType::Step) { // TODO implement CubicSpline
+        __m128 t = _mm_set1_ps(factor);
+
+        __m128 q1[4];
+        LoadTrackGroupKey(animation, group, to, q1);
+
+        if (isRotation) {
+            __m128 d = _mm_mul_ps(v[0], q1[0]);
+            for (uint32_t c = 1; c < 4; c++)
+                d = _mm_add_ps(d, _mm_mul_ps(v[c], q1[c]));
+
+            // Shortest path
+            __m128 flip = _mm_and_ps(d, _mm_set1_ps(-0.0f));
+            d = _mm_xor_ps(d, flip);
+
+            __m128 x = _mm_sub_ps(d, _mm_set1_ps(1.0f));
+            __m128 w0 = _mm_xor_ps(SlerpWeight(_mm_sub_ps(_mm_set1_ps(1.0f), t), x), flip);
+            __m128 w1 = SlerpWeight(t, x);
+
+            __m128 len = _mm_setzero_ps();
+            for (uint32_t c = 0; c < 4; c++) {
+                v[c] = _mm_add_ps(_mm_mul_ps(v[c], w0), _mm_mul_ps(q1[c], w1));
+                len = _mm_add_ps(len, _mm_mul_ps(v[c], v[c]));
+            }
+
+            __m128 invLen = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(len));
+            for (uint32_t c = 0; c < 4; c++)
+                v[c] = _mm_mul_ps(v[c], invLen);
+        } else {
+            for (uint32_t c = 0; c < 3; c++)
+                v[c] = _mm_add_ps(v[c], _mm_mul_ps(_mm_sub_ps(q1[c], v[c]), t));
+        }
+    }
+
+    for (uint32_t c = 0; c < componentNum; c++)
+        _mm_storeu_ps(result[c], v[c]);
+}
 
-void utils::Scene::Animate(float animationSpeed, float elapsedTime, float& animationProgress, uint32_t animationIndex) {
+void utils::Scene::Animate(float animationSpeed, float elapsedTime, float& animationProgress, uint32_t animationIndex, std::vector<uint32_t>* updatedInstanceIndices) {
     Animation& animation = animations[animationIndex];
 
     // Time
@@ -1654,25 +4622,10 @@ void utils::Scene::Animate(float animationSpeed, float elapsedTime, float& anima
 
     float animTimeSec = t * animation.animationTimeSec;
 
-    std::function<uint32_t(std::vector<float>&, float)> findKeyIndex = [](std::vector<float>& keys, float time) {
-        if (time <= keys[0])
-            return (uint32_t)0;
-
-        if (time >= keys.back())
-            return (uint32_t)(keys.size() - 1);
-
-        for (int32_t index = (int32_t)keys.size() - 1; index >= 1; --index) {
-            if (time >= keys[index])
-                return (uint32_t)index;
-        }
-
-        return (uint32_t)0;
-    };
-
     for (auto& track : animation.weightTracks) {
         track.activeValues.clear();
 
-        uint32_t from = findKeyIndex(track.keys, animTimeSec);
+        uint32_t from = FindKeyIndex(track.keys.data(), (uint32_t)track.keys.size(), animTimeSec, track.keyCursor);
         uint32_t to = min(track.frameCount - 1, from + 1);
         float keyFrom = track.keys[from];
         float keyTo = track.keys[to];
@@ -1745,105 +4698,173 @@ void utils::Scene::Animate(float animationSpeed, float elapsedTime, float& anima
         }
     }
 
-    for (auto& track : animation.positionTracks) {
-        uint32_t from = findKeyIndex(track.keys, animTimeSec);
-        uint32_t to = min(track.frameCount - 1, from + 1);
-        float keyFrom = track.keys[from];
-        float keyTo = track.keys[to];
-        float time = animTimeSec < keyFrom ? keyFrom : (animTimeSec > keyTo ? keyTo : animTimeSec);
-        float factor = to != from ? (time - keyFrom) / (keyTo - keyFrom) : 0.0f;
-        float3 value = float3(0.0f, 0.0f, 0.0f);
+    for (AnimationTrackGroup& group : animation.trackGroups) {
+        alignas(16) float result[4][4];
+        EvaluateTrackGroup(animation, group, animTimeSec, group.keyCursor, result);
 
-        switch (track.type) {
-            case AnimationTrackType::Step: {
-                value = track.values[from];
-            } break;
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            uint32_t nodeIndex = group.nodeIndices[lane];
+            if (nodeIndex == InvalidIndex)
+                break;
 
-            case AnimationTrackType::CubicSpline: // TODO implement CubicSpline
-            case AnimationTrackType::Linear: {
-                value = lerp(track.values[from], track.values[to], float3(factor));
-            } break;
+            SceneNode& sceneNode = sceneNodes[nodeIndex];
+            if (group.target == AnimationTrackTarget::TRANSLATION)
+                sceneNode.translation = float3(result[0][lane], result[1][lane], result[2][lane]);
+            else if (group.target == AnimationTrackTarget::ROTATION)
+                sceneNode.rotation = float4(result[0][lane], result[1][lane], result[2][lane], result[3][lane]);
+            else
+                sceneNode.scale = float3(result[0][lane], result[1][lane], result[2][lane]);
         }
-
-        track.node->translation = value;
     }
 
-    for (auto& track : animation.rotationTracks) {
-        uint32_t from = findKeyIndex(track.keys, animTimeSec);
-        uint32_t to = min(track.frameCount - 1, from + 1);
-        float keyFrom = track.keys[from];
-        float keyTo = track.keys[to];
-        float time = animTimeSec < keyFrom ? keyFrom : (animTimeSec > keyTo ? keyTo : animTimeSec);
-        float factor = to != from ? (time - keyFrom) / (keyTo - keyFrom) : 0.0f;
-        float4 value = float4(0.0f, 0.0f, 0.0f, 1.0f);
+    // Hierarchy
+    if (updatedInstanceIndices)
+        updatedInstanceIndices->clear();
 
-        switch (track.type) {
-            case AnimationTrackType::Step: {
-                value = track.values[from];
-            } break;
+    for (uint32_t nodeIndex : animation.dynamicNodes) {
+        SceneNode& sceneNode = sceneNodes[nodeIndex];
 
-            case AnimationTrackType::CubicSpline: // TODO implement CubicSpline
-            case AnimationTrackType::Linear: {
-                float4 a = track.values[from];
-                float4 b = track.values[to];
-                float theta = dot(a, b);
-                a = (theta < 0.0f) ? -a : a;
-                value = Slerp(a, b, factor);
-            } break;
-        }
+        float4x4 translation;
+        translation.SetupByTranslation(sceneNode.translation);
+        float4x4 rotation;
+        rotation.SetupByQuaternion(sceneNode.rotation);
+        float4x4 scale;
+        scale.SetupByScale(sceneNode.scale);
 
-        track.node->rotation = value;
+        sceneNode.localTransform = translation * (rotation * scale);
     }
 
-    for (auto& track : animation.scaleTracks) {
-        uint32_t from = findKeyIndex(track.keys, animTimeSec);
-        uint32_t to = min(track.frameCount - 1, from + 1);
-        float keyFrom = track.keys[from];
-        float keyTo = track.keys[to];
-        float time = animTimeSec < keyFrom ? keyFrom : (animTimeSec > keyTo ? keyTo : animTimeSec);
-        float factor = to != from ? (time - keyFrom) / (keyTo - keyFrom) : 0.0f;
-        float3 value = float3(1.0f, 1.0f, 1.0f);
+    // Subtrees of dynamic nodes are contiguous, since "dynamicNodes" are sorted, nested dynamic nodes are skipped
+    uint32_t nodeEnd = 0;
+    for (uint32_t nodeIndex : animation.dynamicNodes) {
+        if (nodeIndex < nodeEnd)
+            continue;
 
-        switch (track.type) {
-            case AnimationTrackType::Step:
-                value = track.values[from];
-                break;
+        nodeEnd = nodeIndex + sceneNodes[nodeIndex].descendantNum + 1;
+        for (uint32_t i = nodeIndex; i < nodeEnd; i++) {
+            SceneNode& sceneNode = sceneNodes[i];
+            sceneNode.worldTransform = sceneNode.parentIndex != InvalidIndex ? (sceneNodes[sceneNode.parentIndex].worldTransform * sceneNode.localTransform) : (mSceneToWorld * sceneNode.localTransform);
 
-            case AnimationTrackType::CubicSpline: // TODO implement CubicSpline
-            case AnimationTrackType::Linear:
-                value = lerp(track.values[from], track.values[to], float3(factor));
-                break;
-        }
+            float4x4 transform = sceneNode.worldTransform;
+            double3 position = double3(float3(transform[3].xyz));
+            transform.SetTranslation(float3::Zero());
+
+            for (uint32_t instanceIndex : sceneNode.instances) {
+                Instance& instance = this->instances[instanceIndex];
+                instance.rotation = transform;
+                instance.position = position;
+            }
 
-        track.node->scale = value;
+            if (updatedInstanceIndices)
+                updatedInstanceIndices->insert(updatedInstanceIndices->end(), sceneNode.instances.begin(), sceneNode.instances.end());
+        }
     }
+}
 
-    std::function<void(SceneNode*)> updateChain = [&](SceneNode* sceneNode) {
-        float4x4 translation;
-        translation.SetupByTranslation(sceneNode->translation);
-        float4x4 rotation;
-        rotation.SetupByQuaternion(sceneNode->rotation);
-        float4x4 scale;
-        scale.SetupByScale(sceneNode->scale);
+constexpr uint32_t ANIMATION_ACTOR_BATCH_SIZE = 16;
 
-        sceneNode->localTransform = translation * (rotation * scale);
-        sceneNode->worldTransform = sceneNode->parent ? (sceneNode->parent->worldTransform * sceneNode->localTransform) : (mSceneToWorld * sceneNode->localTransform);
+// Weighted sums of clip values, the rest up to the total weight of 1 is taken from the node
+struct ActorNodeBlend {
+    float4 rotation = float4(0.0f, 0.0f, 0.0f, 0.0f);
+    float3 translation = float3(0.0f, 0.0f, 0.0f);
+    float3 scale = float3(0.0f, 0.0f, 0.0f);
+    float translationWeight = 0.0f;
+    float rotationWeight = 0.0f;
+    float scaleWeight = 0.0f;
+};
 
-        float4x4 transform = sceneNode->worldTransform;
-        double3 position = double3(float3(transform[3].xyz));
-        transform.SetTranslation(float3::Zero());
+void utils::AnimateActors(const Scene& scene, AnimationActor* actors, uint32_t actorNum, float elapsedSec) {
+    const std::vector<SceneNode>& sceneNodes = scene.sceneNodes;
+    uint32_t nodeNum = (uint32_t)sceneNodes.size();
 
-        for (auto instanceIndex : sceneNode->instances) {
-            Instance& instance = this->instances[instanceIndex];
-            instance.rotation = transform;
-            instance.position = position;
-        }
+    std::vector<std::vector<ActorNodeBlend>> scratch(GetThreadNum());
 
-        for (auto child : sceneNode->children)
-            updateChain(child);
-    };
+    ParallelFor(actorNum, ANIMATION_ACTOR_BATCH_SIZE, [&](uint32_t begin, uint32_t end, uint32_t threadIndex) {
+        std::vector<ActorNodeBlend>& blends = scratch[threadIndex];
+
+        for (uint32_t actorIndex = begin; actorIndex < end; actorIndex++) {
+            AnimationActor& actor = actors[actorIndex];
+
+            blends.assign(nodeNum, ActorNodeBlend());
+
+            float weightSum = 0.0f;
+            for (const AnimationClipState& clip : actor.clips) {
+                if (clip.animationIndex < scene.animations.size())
+                    weightSum += max(clip.weight, 0.0f);
+            }
+
+            float weightNorm = weightSum > 0.0f ? 1.0f / weightSum : 0.0f;
+
+            // Clips
+            for (AnimationClipState& clip : actor.clips) {
+                if (clip.animationIndex >= scene.animations.size())
+                    continue;
+
+                const Animation& animation = scene.animations[clip.animationIndex];
+
+                float durationSec = animation.animationTimeSec;
+                clip.timeSec = durationSec > 0.0f ? fmodf(clip.timeSec + elapsedSec * clip.speed, durationSec) : 0.0f;
+                if (clip.timeSec < 0.0f)
+                    clip.timeSec += durationSec;
+
+                float weight = max(clip.weight, 0.0f) * weightNorm;
+                if (weight == 0.0f)
+                    continue;
+
+                if (clip.keyCursors.size() != animation.trackGroups.size())
+                    clip.keyCursors.assign(animation.trackGroups.size(), 0);
+
+                for (size_t groupIndex = 0; groupIndex < animation.trackGroups.size(); groupIndex++) {
+                    const AnimationTrackGroup& group = animation.trackGroups[groupIndex];
+
+                    alignas(16) float result[4][4];
+                    EvaluateTrackGroup(animation, group, clip.timeSec, clip.keyCursors[groupIndex], result);
+
+                    for (uint32_t lane = 0; lane < 4; lane++) {
+                        uint32_t nodeIndex = group.nodeIndices[lane];
+                        if (nodeIndex == InvalidIndex)
+                            break;
+
+                        ActorNodeBlend& blend = blends[nodeIndex];
+                        if (group.target == AnimationTrackTarget::TRANSLATION) {
+                            blend.translation += float3(result[0][lane], result[1][lane], result[2][lane]) * weight;
+                            blend.translationWeight += weight;
+                        } else if (group.target == AnimationTrackTarget::ROTATION) {
+                            float4 rotation = float4(result[0][lane], result[1][lane], result[2][lane], result[3][lane]);
+                            if (dot(rotation, sceneNodes[nodeIndex].rotation) < 0.0f) // same hemisphere for all clips
+                                rotation = -rotation;
+
+                            blend.rotation += rotation * weight;
+                            blend.rotationWeight += weight;
+                        } else {
+                            blend.scale += float3(result[0][lane], result[1][lane], result[2][lane]) * weight;
+                            blend.scaleWeight += weight;
+                        }
+                    }
+                }
+            }
+
+            // Pose
+            actor.worldTransforms.resize(nodeNum);
+
+            for (uint32_t nodeIndex = 0; nodeIndex < nodeNum; nodeIndex++) {
+                const SceneNode& sceneNode = sceneNodes[nodeIndex];
+                const ActorNodeBlend& blend = blends[nodeIndex];
 
-    // TODO: this could be optimized by only updating roots of the dynamic chains, i.e. when one dynamic node is hierarchical child of another
-    for (auto node : animation.dynamicNodes)
-        updateChain(node);
+                float4x4 localTransform = sceneNode.localTransform;
+                if (blend.translationWeight != 0.0f || blend.rotationWeight != 0.0f || blend.scaleWeight != 0.0f) {
+                    float4x4 translation;
+                    translation.SetupByTranslation(blend.translation + sceneNode.translation * (1.0f - blend.translationWeight));
+                    float4x4 rotation;
+                    rotation.SetupByQuaternion(normalize(blend.rotation + sceneNode.rotation * (1.0f - blend.rotationWeight)));
+                    float4x4 scale;
+                    scale.SetupByScale(blend.scale + sceneNode.scale * (1.0f - blend.scaleWeight));
+
+                    localTransform = translation * (rotation * scale);
+                }
+
+                actor.worldTransforms[nodeIndex] = sceneNode.parentIndex != InvalidIndex ? (actor.worldTransforms[sceneNode.parentIndex] * localTransform) : (scene.mSceneToWorld * localTransform);
+            }
+        }
+    });
 }